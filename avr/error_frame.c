@@ -19,5 +19,5 @@ void __hj_send_error(uint16_t line, char *file, size_t flen,
 
 	memcpy(err_pkt.file, file, MIN(flen + 1, sizeof(err_pkt.file)));
 
-	frame_send(&err_pkt, HJA_PL_ERROR);
+	frame_send_urgent(&err_pkt, HJA_PL_ERROR);
 }
@@ -6,6 +6,9 @@
 #include <avr/io.h>
 #include <avr/interrupt.h>
 #include <util/crc16.h>
+#ifdef AVR
+# include <util/delay.h>
+#endif
 
 #include <muc/muc.h>
 #include <penny/circ_buf.h>
@@ -13,6 +16,7 @@
 #include <frame/frame_proto.h>
 
 #include "error_led.h"
+#include "frame_async.h"
 
 /* 0x7f => 0x7d, 0x5f
  * 0x7e => 0x7d, 0x5e
@@ -57,7 +61,7 @@
 # define dbgprintf_pbuf(sub, pbuf, fmt, ...) do {	\
 	if (sub & DBG_MASK) {				\
 		printf(fmt, ## __VA_ARGS__);		\
-		print_packet_buf(&pbuf);		\
+		print_packet_buf(pbuf);			\
 		putchar('\n');				\
 	}						\
 } while(0)
@@ -77,17 +81,173 @@
 #define sizeof_member(type, member) \
 	sizeof(((type *)0)->member)
 
-struct packet_buf {
-	uint8_t buf[64]; /* bytes */
+/* ring sizes, may be overridden from the command line. Byte and packet
+ * indexes are uint8_t, and wrap by masking. */
+#ifndef FRAME_RX_BUF_SZ
+# define FRAME_RX_BUF_SZ 64
+#endif
+#ifndef FRAME_RX_PKT_CT
+# define FRAME_RX_PKT_CT 8
+#endif
+#ifndef FRAME_TX_BUF_SZ
+# define FRAME_TX_BUF_SZ 128
+#endif
+#ifndef FRAME_TX_PKT_CT
+# define FRAME_TX_PKT_CT 8
+#endif
+/* urgent frames (errors, timeouts) have a ring of their own, so bulk
+ * traffic can neither delay them nor take their space. It holds two
+ * HJA_PT_ERRORs and a HJA_PT_TIMEOUT, framed, at once. */
+#ifndef FRAME_TXU_BUF_SZ
+# define FRAME_TXU_BUF_SZ 64
+#endif
+#ifndef FRAME_TXU_PKT_CT
+# define FRAME_TXU_PKT_CT 4
+#endif
 
-	/* array of packet starts in bytes (byte heads and tails,
-	 * depending on index */
-	uint8_t p_idx[8];
-	uint8_t head; /* next packet_idx_buf loc to read from (head_packet) */
-	uint8_t tail; /* next packet_idx_buf loc to write to  (tail_packet) */
-};
+/* FRAME_NODE (0 to 63): this board's address on a shared (multi-drop)
+ * line. The rx isr ignores frames for other nodes, and every frame sent
+ * starts with FRAME_ADDR(FRAME_NODE). Without it frames carry no address. */
+#ifdef FRAME_NODE
+# if FRAME_NODE < 0 || FRAME_NODE > 63
+#  error "FRAME_NODE must be from 0 to 63"
+# endif
+# define FRAME_ADDR_SELF FRAME_ADDR(FRAME_NODE)
+# define HDR_ADDR_SZ FRAME_ADDR_SZ
+#else
+# define HDR_ADDR_SZ 0
+#endif
+
+/* FRAME_SEQ: a control byte follows the address (see frame_proto.h). Frames
+ * from the host are taken strictly in N(S) order, the first out of order one
+ * is answered with a REJ and dropped, as are the rest until the host goes
+ * back. Each frame taken is acknowledged by the N(R) of the next I frame
+ * sent, or by an RR if the consumer sends nothing in reply. frame_send and
+ * the builder send I frames, frame_send_urgent sends UI frames (so they may
+ * overtake the others). Nothing is ever resent from here. */
+#ifdef FRAME_SEQ
+# define HDR_CTRL_SZ FRAME_CTRL_SZ
+#else
+# define HDR_CTRL_SZ 0
+#endif
+
+#define FRAME_HDR_SZ (HDR_ADDR_SZ + HDR_CTRL_SZ)
 
-static struct packet_buf rx, tx;
+#define IS_POW2(x) ((x) && !((x) & ((x) - 1)))
+#if !IS_POW2(FRAME_RX_BUF_SZ) || FRAME_RX_BUF_SZ > 256
+# error "FRAME_RX_BUF_SZ must be a power of 2, no larger than 256"
+#endif
+#if !IS_POW2(FRAME_RX_PKT_CT) || FRAME_RX_PKT_CT > 256
+# error "FRAME_RX_PKT_CT must be a power of 2, no larger than 256"
+#endif
+#if !IS_POW2(FRAME_TX_BUF_SZ) || FRAME_TX_BUF_SZ > 256
+# error "FRAME_TX_BUF_SZ must be a power of 2, no larger than 256"
+#endif
+#if !IS_POW2(FRAME_TX_PKT_CT) || FRAME_TX_PKT_CT > 256
+# error "FRAME_TX_PKT_CT must be a power of 2, no larger than 256"
+#endif
+#if !IS_POW2(FRAME_TXU_BUF_SZ) || FRAME_TXU_BUF_SZ > 256
+# error "FRAME_TXU_BUF_SZ must be a power of 2, no larger than 256"
+#endif
+#if !IS_POW2(FRAME_TXU_PKT_CT) || FRAME_TXU_PKT_CT > 256
+# error "FRAME_TXU_PKT_CT must be a power of 2, no larger than 256"
+#endif
+
+#define PACKET_BUF(b_sz, p_sz) struct {					\
+	uint8_t buf[b_sz]; /* bytes */					\
+									\
+	/* array of packet starts in bytes (byte heads and tails,	\
+	 * depending on index */					\
+	uint8_t p_idx[p_sz];						\
+	uint8_t head; /* next packet_idx_buf loc to read from (head_packet) */ \
+	uint8_t tail; /* next packet_idx_buf loc to write to  (tail_packet) */ \
+}
+
+static PACKET_BUF(FRAME_TX_BUF_SZ, FRAME_TX_PKT_CT) tx;
+static PACKET_BUF(FRAME_TXU_BUF_SZ, FRAME_TXU_PKT_CT) txu;
+
+/*
+ * The receive queue. Either
+ *  - (default) a PACKET_BUF, with a separate ring of packet start indexes
+ *  - FRAME_RX_LPQ: a frame_recv_ctx (frame/frame.c), packets stored length
+ *    prefixed in the one array, so the number held is limited only by
+ *    their size. FRAME_RX_PKT_CT is unused.
+ * The consumer side uses it through the rxq_* operations. The rx isr is
+ * written for each.
+ */
+#ifdef FRAME_RX_LPQ
+# define FRAME_RECV_CTX_SZ FRAME_RX_BUF_SZ
+# include <frame/frame.h>
+
+# ifdef FRAME_NODE
+static frame_recv_ctx rx = { .addr = FRAME_ADDR_SELF };
+# else
+static frame_recv_ctx rx;
+# endif
+
+# define RXQ_BUF         (rx.data)
+# define RXQ_SZ          FRAME_RECV_CTX_SZ
+# define rxq_empty()     frame_recv_ctx_empty(&rx)
+# define rxq_ct()        frame_recv_ctx_ct(&rx)
+# define rxq_pos()       frame_recv_ctx_pos(&rx)
+# define rxq_len()       frame_recv_ctx_len(&rx)
+# define rxq_advance(n)  frame_recv_ctx_advance(&rx, n)
+# define rxq_next()      frame_recv_ctx_next(&rx)
+#else
+static PACKET_BUF(FRAME_RX_BUF_SZ, FRAME_RX_PKT_CT) rx;
+
+# define RXQ_BUF         (rx.buf)
+# define RXQ_SZ          B_SZ(rx)
+# define rxq_empty()     (rx.tail == rx.head)
+# define rxq_ct()        CIRC_CNT(rx.head, rx.tail, P_SZ(rx))
+# define rxq_pos()       (rx.p_idx[rx.tail])
+# define rxq_len()       CIRC_CNT(rx.p_idx[CIRC_NEXT(rx.tail, P_SZ(rx))], \
+					rx.p_idx[rx.tail], B_SZ(rx))
+# define rxq_advance(n)  (rx.p_idx[rx.tail] =				\
+			(rx.p_idx[rx.tail] + (n)) & (B_SZ(rx) - 1))
+# define rxq_next()      (rx.tail = CIRC_NEXT(rx.tail, P_SZ(rx)))
+#endif
+
+#ifndef AVR
+const uint16_t frame_rx_ram = sizeof(rx);
+#endif
+
+/* peak occupancy, see frame_hwm_get() */
+static struct frame_hwm hwm;
+
+/* reasons for dropping frames, see frame_stats_get() */
+static struct frame_stats stats;
+
+#ifdef FRAME_CREDIT
+/* frames the rx isr has finished with, whether queued or dropped */
+static uint8_t credit_seen;
+/* frames the consumer has freed since the last frame_credit_get() */
+static uint8_t credit_freed;
+
+# ifndef FRAME_CREDIT_STEP
+#  define FRAME_CREDIT_STEP (FRAME_RX_PKT_CT / 2)
+# endif
+# define CREDIT_SEEN()  (credit_seen++)
+# define CREDIT_FREED() (credit_freed++)
+#else
+# define CREDIT_SEEN()  do {} while (0)
+# define CREDIT_FREED() do {} while (0)
+#endif
+
+#define STAT_INC(ct) do {			\
+	if ((ct) != UINT16_MAX)			\
+		(ct)++;				\
+} while(0)
+
+#define HWM_UPDATE(circ, ih_1, bytes, pkts) do {			\
+	uint8_t b_ = CIRC_CNT((circ).p_idx[ih_1],			\
+			(circ).p_idx[(circ).tail], B_SZ(circ));		\
+	uint8_t p_ = CIRC_CNT(ih_1, (circ).tail, P_SZ(circ));		\
+	if (b_ > (bytes))						\
+		(bytes) = b_;						\
+	if (p_ > (pkts))						\
+		(pkts) = p_;						\
+} while(0)
 
 #if defined(AVR)
 # if DBG_MASK
@@ -120,10 +280,20 @@ static FILE usart0_io_direct =
 		asm("":::"memory");       \
 	} while(0)
 
+# define usart0_rx_lock() do {             \
+		UCSR0B &= ~(1 << RXCIE0); \
+		asm("":::"memory");       \
+	} while(0)
+# define usart0_rx_unlock() do {           \
+		UCSR0B |= (1 << RXCIE0);  \
+		asm("":::"memory");       \
+	} while(0)
+
 # define RX_BYTE_GET() UDR0
 # define RX_STATUS_GET() UCSR0A
-# define RX_STATUS_IS_ERROR(status) ((status) &          \
-		((1 << FE0) | (1 << DOR0) | (1<< UPE0)))
+# define RX_ERR_FRAME   (1 << FE0)
+# define RX_ERR_OVERRUN (1 << DOR0)
+# define RX_ERR_PARITY  (1 << UPE0)
 
 # define TX_BYTE_SEND(byte) (UDR0 = (byte))
 
@@ -136,14 +306,22 @@ static FILE usart0_io_direct =
 #  define print_wait()
 # endif
 
-# define usart0_udre_isr_on()
-# define usart0_udre_unlock()
-# define usart0_udre_isr_off()
-# define usart0_udre_lock()
+/* stands in for UDRIE0, so a simulation knows when to stop calling
+ * frame_tx_isr() */
+bool frame_udre_ie;
+# define usart0_udre_isr_on()  (frame_udre_ie = true)
+# define usart0_udre_unlock()  (frame_udre_ie = true)
+# define usart0_udre_isr_off() (frame_udre_ie = false)
+# define usart0_udre_lock()    (frame_udre_ie = false)
+
+# define usart0_rx_lock()
+# define usart0_rx_unlock()
 
 # define RX_BYTE_GET() getchar()
 # define RX_STATUS_GET() 0
-# define RX_STATUS_IS_ERROR(status) false
+# define RX_ERR_FRAME   (1 << 4)
+# define RX_ERR_OVERRUN (1 << 3)
+# define RX_ERR_PARITY  (1 << 2)
 
 # define TX_BYTE_SEND(byte) putchar(byte)
 
@@ -152,34 +330,43 @@ static FILE usart0_io_direct =
 
 #endif
 
+#define RX_STATUS_IS_ERROR(status) ((status) &				\
+		(RX_ERR_FRAME | RX_ERR_OVERRUN | RX_ERR_PARITY))
+
 
 #if (DBG_MASK)
-static void print_packet_buf(struct packet_buf *b)
+static void print_packet_buf_(uint8_t head, uint8_t tail,
+		const uint8_t *p_idx, uint8_t p_sz,
+		const uint8_t *buf, uint16_t b_sz)
 {
-	printf("head %02d  tail %02d  p_idx(%d) ", b->head,
-			b->tail, sizeof(b->p_idx));
-	uint8_t i;
+	printf("head %02d  tail %02d  p_idx(%d) ", head, tail, p_sz);
+	uint16_t i;
 	for (i = 0; ;) {
-		printf("%d", b->p_idx[i]);
+		printf("%d", p_idx[i]);
 		i++;
-		if (i < sizeof(b->p_idx))
+		if (i < p_sz)
 			putchar(' ');
 		else
 			break;
 	}
 
 	printf("  buf ");
-	for(i = 0; i < sizeof(b->buf); i++) {
-		printf("%c ", b->buf[i]);
+	for(i = 0; i < b_sz; i++) {
+		printf("%c ", buf[i]);
 	}
 }
 
+#define print_packet_buf(b) print_packet_buf_((b).head, (b).tail,	\
+		(b).p_idx, P_SZ(b), (b).buf, B_SZ(b))
+
 static unused void frame_timeout(void)
 {
 	printf("\n{{ tx: ");
-	print_packet_buf(&tx);
+	print_packet_buf(tx);
+#ifndef FRAME_RX_LPQ
 	printf(" }}\n{{ rx: ");
-	print_packet_buf(&rx);
+	print_packet_buf(rx);
+#endif
 	printf(" }}\n");
 }
 #endif /* DBG_MASK */
@@ -196,19 +383,135 @@ static unused void frame_timeout(void)
  * next packet. Packets *are not* advanced automatically under any condition.
  */
 
+/*
+ * The rx isr only unescapes and stores bytes, leaving the crc on the end of
+ * each packet (and with FRAME_NODE/FRAME_SEQ, the address and control byte
+ * at its start). The current packet (the oldest in the queue) is checked
+ * here, the first time the consumer looks at it, and discarded if it is bad
+ * (or with FRAME_SEQ, out of order or carrying no data).
+ *
+ * rx_valid: the current packet has passed its crc check.
+ * rx_left:  bytes of it (excluding header and crc) not yet read by the
+ *           consumer.
+ */
+static bool rx_valid;
+static uint8_t rx_left;
+
+#ifdef FRAME_SEQ
+/* S and U frames are only a header, I frames must carry data */
+# define RX_MIN_SZ (FRAME_HDR_SZ + FRAME_CRC_SZ)
+
+static uint8_t seq_vs;		/* N(S) of the next I frame sent */
+static uint8_t seq_vr;		/* N(S) expected of the next I frame received */
+static bool seq_ack_due;	/* I frames were taken since the last N(R) sent */
+static bool seq_rej_sent;	/* dropping out of order frames */
+
+static void frame_send_ctrl(uint8_t ctrl);
+
+/*
+ * seq_rx - act on the control byte of a good frame.
+ *
+ * return: true if the frame's data is to be passed to the consumer.
+ */
+static bool seq_rx(uint8_t ctrl, uint8_t ct)
+{
+	if (FRAME_CTRL_IS_I(ctrl)) {
+		if (FRAME_CTRL_NS(ctrl) != seq_vr) {
+			/* either one before it was lost, and the host goes
+			 * back to seq_vr when it sees the REJ, or it was taken
+			 * already and the host is resending after a timeout.
+			 * The first of those is a poll (P set), answered so
+			 * that it learns how far we got. */
+			if (ctrl & FRAME_CTRL_PF) {
+				frame_send_ctrl(FRAME_CTRL_RR(seq_vr)
+						| FRAME_CTRL_PF);
+			} else if (!seq_rej_sent) {
+				seq_rej_sent = true;
+				frame_send_ctrl(FRAME_CTRL_REJ(seq_vr));
+			}
+			return false;
+		}
+
+		seq_vr = (seq_vr + 1) & FRAME_SEQ_MASK;
+		seq_rej_sent = false;
+		seq_ack_due = true;
+		return ct > RX_MIN_SZ;
+	}
+
+	if (FRAME_CTRL_U(ctrl) == FRAME_CTRL_SABM) {
+		seq_vs = 0;
+		seq_vr = 0;
+		seq_rej_sent = false;
+		seq_ack_due = false;
+		frame_send_ctrl(FRAME_CTRL_UA | (ctrl & FRAME_CTRL_PF));
+		return false;
+	}
+
+	if (FRAME_CTRL_U(ctrl) == FRAME_CTRL_UI)
+		return ct > RX_MIN_SZ;
+
+	/* S frames only acknowledge ours, which are never resent */
+	return false;
+}
+#else
+# define RX_MIN_SZ (FRAME_HDR_SZ + FRAME_CRC_SZ + 1)
+#endif
+
+static bool rx_pkt_check(void)
+{
+	if (rx_valid)
+		return true;
+
+	while (!rxq_empty()) {
+		uint8_t b_it = rxq_pos();
+		uint8_t ct = rxq_len();
+		uint16_t crc = FRAME_CRC_INIT;
+		uint8_t i;
+
+		for (i = 0; i < ct; i++) {
+			crc = _crc_ccitt_update(crc, RXQ_BUF[b_it]);
+			b_it = CIRC_NEXT(b_it, RXQ_SZ);
+		}
+
+		if (ct < RX_MIN_SZ || crc != FRAME_CRC_GOOD) {
+			dbgprintf(DBG_RX_MAIN, "rx drop: ct(%d) crc(%d)\n",
+					ct, crc);
+			STAT_INC(stats.rx_crc);
+			rxq_next();
+			CREDIT_FREED();
+			continue;
+		}
+
+#ifdef FRAME_SEQ
+		/* the isr has already checked the address */
+		b_it = (rxq_pos() + HDR_ADDR_SZ) & (RXQ_SZ - 1);
+		if (!seq_rx(RXQ_BUF[b_it], ct)) {
+			rxq_next();
+			CREDIT_FREED();
+			continue;
+		}
+#endif
+
+#if FRAME_HDR_SZ
+		rxq_advance(FRAME_HDR_SZ);
+#endif
+		rx_left = ct - FRAME_HDR_SZ - FRAME_CRC_SZ;
+		rx_valid = true;
+		return true;
+	}
+
+	return false;
+}
+
 /* return: number of bytes in the current packet. 0 indicates the lack of
  * a packet (packets cannot be 0 bytes).
  */
 uint8_t frame_recv_len(void)
 {
-	uint8_t it = rx.tail;
-	if (it != rx.head) {
-		return CIRC_CNT(rx.p_idx[CIRC_NEXT(it,P_SZ(rx))],
-				rx.p_idx[it],
-				B_SZ(rx));
-	} else {
+	if (!rx_pkt_check())
 		return 0;
-	}
+
+	return rx_left;
 }
 
 /* return: next byte from packet.
@@ -222,18 +525,13 @@ uint8_t frame_recv_len(void)
  */
 uint8_t frame_recv_byte(void)
 {
-	uint8_t it = rx.tail;
-	uint8_t b_it = rx.p_idx[it];
-	uint8_t it_1 = CIRC_NEXT(it, P_SZ(rx));
-	uint8_t b_it_1 = rx.p_idx[it_1];
-
-	if ((it != rx.head) && (b_it != b_it_1)) {
-		uint8_t data = rx.buf[b_it];
-		rx.p_idx[it] = CIRC_NEXT(b_it, B_SZ(rx));
-		return data;
-	} else {
+	if (!rx_pkt_check() || !rx_left)
 		return 0;
-	}
+
+	uint8_t data = RXQ_BUF[rxq_pos()];
+	rxq_advance(1);
+	rx_left--;
+	return data;
 }
 
 /* dst: array of at least len bytes into which the current packet is copied
@@ -243,26 +541,47 @@ uint8_t frame_recv_byte(void)
  */
 uint8_t frame_recv_copy(uint8_t *dst, uint8_t len)
 {
-	uint8_t it = rx.tail;
-	if (it != rx.head) {
-		uint8_t b_it = rx.p_idx[it];
-		uint8_t it_1 = CIRC_NEXT(it, P_SZ(rx));
-		uint8_t b_it_1 = rx.p_idx[it_1];
-		uint8_t ct = CIRC_CNT(b_it_1, b_it, B_SZ(rx));
-		uint8_t ct_to_end = CIRC_CNT_TO_END(b_it_1, b_it, B_SZ(rx));
+	if (!rx_pkt_check())
+		return 0;
 
-		uint8_t cpy_ct = MIN(len, ct);
-		uint8_t cpy1_len = MIN(len, ct_to_end);
-		uint8_t cpy2_len = cpy_ct - cpy1_len;
+	uint8_t b_it = rxq_pos();
+	uint8_t ct = rx_left;
 
-		memcpy(dst, rx.buf + b_it, cpy1_len);
-		memcpy(dst + cpy1_len, rx.buf, cpy2_len);
+	uint8_t cpy_ct = MIN(len, ct);
+	uint8_t cpy1_len = MIN(cpy_ct, RXQ_SZ - b_it);
+	uint8_t cpy2_len = cpy_ct - cpy1_len;
 
-		rx.p_idx[it] = (b_it + cpy_ct) & (B_SZ(rx) - 1);
-		return ct;
-	} else {
+	memcpy(dst, RXQ_BUF + b_it, cpy1_len);
+	memcpy(dst + cpy1_len, RXQ_BUF, cpy2_len);
+
+	rxq_advance(cpy_ct);
+	rx_left -= cpy_ct;
+	return ct;
+}
+
+/* seg: filled with the unread bytes of the current packet, which are
+ *      contiguous in the rx queue unless they wrap around its end.
+ * return: the number of segments used, 0 when there is no packet.
+ * the byte pointer is not advanced, the segments remain valid until
+ * frame_recv_next.
+ */
+uint8_t frame_recv_peek(struct frame_seg seg[2])
+{
+	if (!rx_pkt_check())
 		return 0;
-	}
+
+	uint8_t b_it = rxq_pos();
+	uint8_t len1 = MIN(rx_left, RXQ_SZ - b_it);
+
+	seg[0].p = RXQ_BUF + b_it;
+	seg[0].len = len1;
+
+	if (len1 == rx_left)
+		return 1;
+
+	seg[1].p = RXQ_BUF;
+	seg[1].len = rx_left - len1;
+	return 2;
 }
 
 /* advance the packet pointer to the next packet.
@@ -276,8 +595,18 @@ uint8_t frame_recv_copy(uint8_t *dst, uint8_t len)
  */
 void frame_recv_next(void)
 {
-	uint8_t it_1 = CIRC_NEXT(rx.tail, P_SZ(rx));
-	rx.tail = it_1;
+	rx_valid = false;
+	rxq_next();
+	CREDIT_FREED();
+
+#ifdef FRAME_SEQ
+	/* nothing was sent in reply. Unless the next frame (whose reply
+	 * will do) is already here, acknowledge this one by itself. */
+	if (seq_ack_due && !rx_pkt_check()) {
+		seq_ack_due = false;
+		frame_send_ctrl(FRAME_CTRL_RR(seq_vr));
+	}
+#endif
 }
 
 /* return: true if at least one packet is in the queue. The queue includes
@@ -285,28 +614,86 @@ void frame_recv_next(void)
  */
 bool frame_recv_have_pkt(void)
 {
-	return rx.tail != rx.head;
+	return rx_pkt_check();
 }
 
 /* return: the number of packets presently in the queue. The queue includes
- *         the packet currently being processed.
+ *         the packet currently being processed. Packets which have not yet
+ *         had their crc checked are counted.
  */
 uint8_t frame_recv_ct(void)
 {
-	return CIRC_CNT(rx.head, rx.tail, P_SZ(rx));
+	return rxq_ct();
 }
 
 /** recieve: producer, modifies head **/
+#ifdef FRAME_RX_LPQ
+RX_ISR()
+{
+	uint8_t status = RX_STATUS_GET();
+	uint8_t data = RX_BYTE_GET();
+
+	/* check `status` for error conditions */
+	if (RX_STATUS_IS_ERROR(status)) {
+		/* frame error, data over run, parity error */
+		if (status & RX_ERR_FRAME)
+			STAT_INC(stats.rx_frame_err);
+		if (status & RX_ERR_OVERRUN)
+			STAT_INC(stats.rx_overrun);
+		if (status & RX_ERR_PARITY)
+			STAT_INC(stats.rx_parity);
+		if (rx.data[rx.head])
+			CREDIT_SEEN();
+		frame_recv_ctx_error(&rx);
+		return;
+	}
+
+#ifdef FRAME_CREDIT
+	/* a FRAME_RESET only drops something if it was started */
+	uint8_t rx_had = rx.data[rx.head];
+#endif
+
+	switch (frame_recv_ctx_feed(&rx, data)) {
+	case FRAME_RECV_PKT: {
+		CREDIT_SEEN();
+		uint8_t b = CIRC_CNT(rx.head, rx.tail, RXQ_SZ);
+		uint8_t p = rxq_ct();
+		if (b > hwm.rx_bytes)
+			hwm.rx_bytes = b;
+		if (p > hwm.rx_pkts)
+			hwm.rx_pkts = p;
+		break;
+	}
+	case FRAME_RECV_FULL:
+		STAT_INC(stats.rx_buf_full);
+		CREDIT_SEEN();
+		break;
+	case FRAME_RECV_ABORT:
+		STAT_INC(stats.rx_abort);
+#ifdef FRAME_CREDIT
+		if (rx_had)
+			CREDIT_SEEN();
+#endif
+		break;
+	default:
+		break;
+	}
+}
+#else
 RX_ISR()
 {
 	dbgprintf_pbuf(DBG_RX_ISR, rx, "rx_isr: ");
 	dbgflush(DBG_RX_ISR);
 
+	/* FRAME_COBS: a zero ends the current run */
 	static bool is_escaped;
 	static bool recv_started;
+#ifdef FRAME_COBS
+	/* bytes of the run still to come, the next is a code byte at 0 */
+	static uint8_t cobs_left;
+#endif
 	uint8_t status = RX_STATUS_GET();
 	uint8_t data = RX_BYTE_GET();
-	static uint16_t crc;
 
 	dbgprintf(DBG_RX_ISR, "\tdata=0x%x\n", data);
 
@@ -319,59 +706,57 @@ RX_ISR()
 	if (RX_STATUS_IS_ERROR(status)) {
 		/* frame error, data over run, parity error */
 		dbgprintf(DBG_RX_ISR, "\tframe error\n");
+		if (status & RX_ERR_FRAME)
+			STAT_INC(stats.rx_frame_err);
+		if (status & RX_ERR_OVERRUN)
+			STAT_INC(stats.rx_overrun);
+		if (status & RX_ERR_PARITY)
+			STAT_INC(stats.rx_parity);
 		goto drop_packet;
 	}
 
-	if (data == FRAME_START) {
+	if (data == FRAME_DELIM) {
 		/* prepare for start, reset packet position, etc. */
 		/* packet length is non-zero */
 		recv_started = true;
 		is_escaped = false;
+#ifdef FRAME_COBS
+		cobs_left = 0;
+#endif
 
 		dbgprintf(DBG_RX_ISR, "\tdata == FRAME_START\n");
 
 		/* is there any data in the packet? */
 		if (rx.p_idx[ih] != rx.p_idx[ih_1]) {
-			/* packet has data, check crc. */
+			/* packet has data, the consumer checks the crc. */
+			CREDIT_SEEN();
 			uint8_t ih_2 = CIRC_NEXT(ih_1, P_SZ(rx));
-			if (ih_2 == rx.tail || crc != 0) {
-				/* no space in p_idx for another packet,
-				 * or invalid crc. */
+			if (ih_2 == rx.tail) {
+				/* no space in p_idx for another packet. */
 
 				/* Essentailly a packet drop, but we want
 				 * recv_started set as this is a FRAME_START,
 				 * after all. */
 				dbgprintf(DBG_RX_ISR,
 					"\t\trx drop: ih_2(%d) =="
-						" rx.tail(%d) || "
-						" crc(%d) != 0\n",
-						ih_2, rx.tail, crc);
+						" rx.tail(%d)\n",
+						ih_2, rx.tail);
+				STAT_INC(stats.rx_pkt_full);
 				rx.p_idx[ih_1] = rx.p_idx[ih];
 			} else {
 				dbgprintf(DBG_RX_ISR,
 					"\t\trx advance.\n");
-				/* advance the packet idx */
-				/* end of packet without CRC */
-				uint8_t b_ih_1_n2 = (rx.p_idx[ih_1] - FRAME_CRC_SZ) &
-							(B_SZ(rx) - 1);
-				rx.p_idx[ih_1] = b_ih_1_n2;
-
-				/* XXX: may not be needed?
-				 * rx.p_idx[next_head] will be set correctly,
-				 * update rx.p_idx[next_next_head] to be the
-				 * same as rx.p_idx[next_head]
-				 */
-				rx.p_idx[ih_2] = b_ih_1_n2;
+				/* advance the packet idx, the packet
+				 * (crc included) ends at rx.p_idx[ih_1] */
+				rx.p_idx[ih_2] = rx.p_idx[ih_1];
 
+				HWM_UPDATE(rx, ih_1, hwm.rx_bytes, hwm.rx_pkts);
 				rx.head = ih_1;
 			}
 		}
 
-		dbgprintf(DBG_RX_ISR, "\tno data, reseting crc.");
-
 		/* otherwise, we have zero bytes in the packet, no need to
 		 * advance */
-		crc = FRAME_CRC_INIT;
 		return;
 	}
 
@@ -381,7 +766,22 @@ RX_ISR()
 		return;
 	}
 
+#ifdef FRAME_COBS
+	if (!cobs_left) {
+		/* a code byte, store the zero ending the last run (if it
+		 * had one) in its place */
+		bool zero = is_escaped;
+		cobs_left = data - 1;
+		is_escaped = data != FRAME_COBS_MAX;
+		if (!zero)
+			return;
+		data = 0;
+	} else {
+		cobs_left--;
+	}
+#else
 	if (data == FRAME_RESET) {
+		STAT_INC(stats.rx_abort);
 		goto drop_packet;
 	}
 
@@ -399,8 +799,16 @@ RX_ISR()
 		is_escaped = false;
 		data ^= FRAME_ESC_MASK;
 	}
+#endif
 
-	crc = _crc_ccitt_update(crc, data);
+#ifdef FRAME_NODE
+	if (rx.p_idx[ih_1] == rx.p_idx[ih] && data != FRAME_ADDR_SELF
+			&& data != FRAME_ADDR_BCAST) {
+		/* for another node, ignore it until the next flag */
+		recv_started = false;
+		return;
+	}
+#endif
 
 	/* do we have another byte to write into? */
 	uint8_t b_ih_1 = rx.p_idx[ih_1];
@@ -417,6 +825,7 @@ RX_ISR()
 			b_it, b_ih_1_1);
 
 	/* well, shucks. we're out of space, drop the packet */
+	STAT_INC(stats.rx_buf_full);
 	/* goto drop_packet; */
 
 drop_packet:
@@ -424,13 +833,72 @@ drop_packet:
 	dbgprintf(DBG_RX_ISR, "\tdrop_packet\n");
 	recv_started = false;
 	is_escaped = false;
-	crc = FRAME_CRC_INIT;
+#ifdef FRAME_CREDIT
+	if (rx.p_idx[ih_1] != rx.p_idx[ih])
+		CREDIT_SEEN();
+#endif
 	/* first byte of the sequence we are writing to; */
 	rx.p_idx[ih_1] = rx.p_idx[ih];
 }
+#endif /* FRAME_RX_LPQ */
 
 /*** Transmision of Data ***/
 /** transmit: consumer of data, modifies tail **/
+#define TX_PENDING(circ) ((circ).tail != (circ).head)
+
+/*
+ * TX_NEXT - send the next byte of the frame at the tail of @circ, or
+ *           if it has all been sent, advance the tail and set @end.
+ */
+#ifdef FRAME_COBS
+/* frames are queued already encoded (TX_COBS_PUT8), so go out as they are */
+#define TX_NEXT(circ, end) do {						\
+	uint8_t it = (circ).tail;					\
+	uint8_t b_it = (circ).p_idx[it];				\
+	uint8_t it_1 = CIRC_NEXT(it, P_SZ(circ));			\
+									\
+	if (b_it == (circ).p_idx[it_1]) {				\
+		/* no more bytes, advance the packet idx. */		\
+		(circ).tail = it_1;					\
+		end = true;						\
+		break;							\
+	}								\
+									\
+	TX_BYTE_SEND((circ).buf[b_it]);					\
+	(circ).p_idx[it] = CIRC_NEXT(b_it, B_SZ(circ));			\
+} while(0)
+#else
+#define TX_NEXT(circ, end) do {						\
+	uint8_t it = (circ).tail;					\
+	uint8_t b_it = (circ).p_idx[it];				\
+	uint8_t it_1 = CIRC_NEXT(it, P_SZ(circ));			\
+									\
+	if (b_it == (circ).p_idx[it_1]) {				\
+		/* no more bytes, advance the packet idx. */		\
+		(circ).tail = it_1;					\
+		end = true;						\
+		break;							\
+	}								\
+									\
+	uint8_t data = (circ).buf[b_it];				\
+	if (is_escaped) {						\
+		is_escaped = false;					\
+		data ^= FRAME_ESC_MASK;					\
+	} else if FRAME_ESC_CHECK(data) {				\
+		/* the byte itself goes out next time round, the	\
+		 * buffer is left untouched */				\
+		is_escaped = true;					\
+		TX_BYTE_SEND(FRAME_ESC);				\
+		break;							\
+	}								\
+									\
+	TX_BYTE_SEND(data);						\
+									\
+	/* Advance byte pointer */					\
+	(circ).p_idx[it] = CIRC_NEXT(b_it, B_SZ(circ));			\
+} while(0)
+#endif
+
 TX_ISR()
 {
 	/* Only enabled when we have data.
@@ -438,60 +906,63 @@ TX_ISR()
 	 * Tail advanced on packet completion.
 	 *
 	 * Expectations:
-	 *    tx.p_idx[tx.tail] is the next byte to transmit
-	 *    tx.p_idx[next_tail] is the end of the currently
+	 *    p_idx[tail] is the next byte to transmit
+	 *    p_idx[next_tail] is the end of the currently
 	 *        transmitted packet
+	 *
+	 * Frames are taken from txu in preference to tx, but only between
+	 * frames.
 	 */
 	static bool packet_started;
-	uint8_t it = tx.tail;
-	uint8_t b_it = tx.p_idx[it];
-	uint8_t it_1 = CIRC_NEXT(it, P_SZ(tx));
+	/* the frame being sent is from txu */
+	static bool urgent;
+#ifndef FRAME_COBS
+	/* the escape for the byte at p_idx[tail] has been sent */
+	static bool is_escaped;
+#endif
 
 	dbgprintf_pbuf(DBG_TX_ISR, tx, "tx_isr: ");
 	dbgflush(DBG_TX_ISR);
 
-	if (b_it == tx.p_idx[it_1]) {
-		/* no more bytes, signal packet completion */
-		/* advance the packet idx. */
-		tx.tail = it_1;
-		if (it_1 == tx.head) {
-			packet_started = false;
-			usart0_udre_lock();
+	if (!packet_started) {
+		/* is it a new packet? */
+		if (TX_PENDING(txu)) {
+			urgent = true;
+		} else if (TX_PENDING(tx)) {
+			urgent = false;
 		} else {
-			packet_started = true;
+			/* Error case for UDRIE enabled when rings are
+			 * empty */
+			usart0_udre_isr_off();
+			return;
 		}
 
-		TX_BYTE_SEND(FRAME_START);
-		return;
-	}
-
-	/* Error case for UDRIE enabled when ring empty
-	 * no packet indexes seen */
-	if (it == tx.head) {
-		packet_started = false;
-		usart0_udre_isr_off();
-		return;
-	}
-
-	/* is it a new packet? */
-	if (!packet_started) {
 		packet_started = true;
-		TX_BYTE_SEND(FRAME_START);
+		TX_BYTE_SEND(FRAME_DELIM);
 		return;
 	}
 
-	uint8_t data = tx.buf[b_it];
+	bool end = false;
+	if (urgent)
+		TX_NEXT(txu, end);
+	else
+		TX_NEXT(tx, end);
 
-	if FRAME_ESC_CHECK(data) {
-		TX_BYTE_SEND(FRAME_ESC);
-		tx.buf[b_it] = data ^ FRAME_ESC_MASK;
+	if (!end)
 		return;
-	}
 
-	TX_BYTE_SEND(data);
+	/* signal packet completion, the flag also starts the next packet
+	 * if there is one. */
+	if (TX_PENDING(txu)) {
+		urgent = true;
+	} else if (TX_PENDING(tx)) {
+		urgent = false;
+	} else {
+		packet_started = false;
+		usart0_udre_lock();
+	}
 
-	/* Advance byte pointer */
-	tx.p_idx[it] = CIRC_NEXT(b_it, B_SZ(tx));
+	TX_BYTE_SEND(FRAME_DELIM);
 }
 
 /** transmit: producer of data, modifies head **/
@@ -499,7 +970,7 @@ TX_ISR()
  *  - packet building:
  *     frame_{start,append*,done}
  *  - full packet sending:
- *     frame_send
+ *     frame_send, frame_send_urgent
  */
 
 #define FRAME_DROP(circ, ih_1, ih) do {				\
@@ -515,6 +986,33 @@ TX_ISR()
 	(circ).p_idx[ih_1] = CIRC_NEXT(b_ih_1, B_SZ(circ));		\
 } while(0)
 
+#ifdef FRAME_COBS
+/*
+ * TX_COBS_PUT8 - store @x at @b_ih, COBS encoded. A zero (not stored) or a
+ *                run reaching 254 bytes ends the run whose code byte is at
+ *                @code, filling it in, and the next run's is kept at @b_ih.
+ *                The last run's code is filled in once the frame is done.
+ */
+#define TX_COBS_PUT8(circ, b_ih, code, run, x) do {			\
+	if (x) {							\
+		(circ).buf[b_ih] = (x);					\
+		b_ih = CIRC_NEXT(b_ih, B_SZ(circ));			\
+		if (++(run) != FRAME_COBS_MAX - 1)			\
+			break;						\
+	}								\
+	(circ).buf[code] = (run) + 1;					\
+	code = b_ih;							\
+	b_ih = CIRC_NEXT(b_ih, B_SZ(circ));				\
+	(run) = 0;							\
+} while(0)
+
+/* code bytes a frame may need: the first, and one more for a run of 254
+ * (no frame held by a ring of 256 bytes can have two) */
+# define TX_COBS_SZ 2
+#else
+# define TX_COBS_SZ 0
+#endif
+
 #define PBUF_APPEND16(circ, val) do {					\
 	PBUF_APPEND8(circ, (uint8_t)(val >> 8));			\
 	PBUF_APPEND8(circ, (uint8_t)(val & 0xff));			\
@@ -523,21 +1021,26 @@ TX_ISR()
 
 static bool frame_start_flag;
 static uint16_t frame_crc_temp;
-void frame_start(void)
-{
-	if (CIRC_SPACE(tx.head, tx.tail, P_SZ(tx)) < FRAME_CRC_SZ) {
-		return;
-	}
-
-	frame_start_flag = true;
-	tx.p_idx[CIRC_NEXT(tx.head, P_SZ(tx))] = tx.p_idx[tx.head];
-	frame_crc_temp = 0xffff;
-}
+#ifdef FRAME_SEQ
+/* the frame being built took an N(S), and cleared this pending ack */
+static bool frame_numbered;
+static bool frame_ack_was;
+#endif
+#ifdef FRAME_COBS
+static uint8_t frame_cobs_code;
+static uint8_t frame_cobs_run;
+#endif
 
-void frame_append_u8(uint8_t x)
+/*
+ * frame_room - check that @n more bytes (and the crc) fit in the packet being
+ *              built, dropping it if not.
+ *
+ * return: true if the bytes may be appended.
+ */
+static bool frame_room(uint8_t n)
 {
 	if (!frame_start_flag)
-		return;
+		return false;
 
 	uint8_t ih = tx.head;
 	uint8_t ih_1 = CIRC_NEXT(ih, P_SZ(tx));
@@ -545,38 +1048,133 @@ void frame_append_u8(uint8_t x)
 
 	/* Can we advance our packet bytes? if not, drop packet */
 	if (CIRC_SPACE(b_ih_1, tx.p_idx[tx.tail], B_SZ(tx))
-			< (sizeof(uint8_t) + FRAME_CRC_SZ)) {
+			< (n + FRAME_CRC_SZ + TX_COBS_SZ)) {
 		FRAME_DROP(tx, ih_1, ih);
+		STAT_INC(stats.tx_full);
+#ifdef FRAME_SEQ
+		/* never sent: the next frame takes its N(S), and the ack */
+		if (frame_numbered) {
+			seq_vs = (seq_vs - 1) & FRAME_SEQ_MASK;
+			seq_ack_due |= frame_ack_was;
+			frame_numbered = false;
+		}
+#endif
+		return false;
+	}
+
+	return true;
+}
+
+#ifdef FRAME_COBS
+# define FRAME_PUT8(x) do {						\
+	uint8_t ih_1_ = CIRC_NEXT(tx.head, P_SZ(tx));			\
+	uint8_t b_ = tx.p_idx[ih_1_];					\
+	uint8_t x_ = (x);						\
+	TX_COBS_PUT8(tx, b_, frame_cobs_code, frame_cobs_run, x_);	\
+	tx.p_idx[ih_1_] = b_;						\
+} while(0)
+#else
+# define FRAME_PUT8(x) PBUF_APPEND8(tx, (x))
+#endif
+
+#define FRAME_APPEND8(x) do {						\
+	frame_crc_temp = _crc_ccitt_update(frame_crc_temp, (x));	\
+	FRAME_PUT8(x);							\
+} while(0)
+
+#ifdef FRAME_SEQ
+/* the control byte of the next I frame, which acknowledges all taken */
+static uint8_t seq_ctrl_i(void)
+{
+	uint8_t c = FRAME_CTRL_I(seq_vs, seq_vr);
+	seq_vs = (seq_vs + 1) & FRAME_SEQ_MASK;
+	seq_ack_due = false;
+	return c;
+}
+#endif
+
+void frame_start(void)
+{
+	if (CIRC_SPACE(tx.head, tx.tail, P_SZ(tx)) < FRAME_CRC_SZ) {
+		STAT_INC(stats.tx_full);
 		return;
 	}
 
-	frame_crc_temp = _crc_ccitt_update(frame_crc_temp, x);
+	frame_start_flag = true;
+	tx.p_idx[CIRC_NEXT(tx.head, P_SZ(tx))] = tx.p_idx[tx.head];
+	frame_crc_temp = FRAME_CRC_INIT;
+#ifdef FRAME_SEQ
+	frame_numbered = false;
+#endif
+
+#ifdef FRAME_COBS
+	if (!frame_room(0))
+		return;
+	/* the first run's code byte */
+	uint8_t ih_1 = CIRC_NEXT(tx.head, P_SZ(tx));
+	frame_cobs_code = tx.p_idx[ih_1];
+	tx.p_idx[ih_1] = CIRC_NEXT(frame_cobs_code, B_SZ(tx));
+	frame_cobs_run = 0;
+#endif
 
-	PBUF_APPEND8(tx, x);
+#if FRAME_HDR_SZ
+	if (!frame_room(FRAME_HDR_SZ))
+		return;
+# ifdef FRAME_NODE
+	FRAME_APPEND8(FRAME_ADDR_SELF);
+# endif
+# ifdef FRAME_SEQ
+	frame_ack_was = seq_ack_due;
+	uint8_t ctrl = seq_ctrl_i();
+	frame_numbered = true;
+	FRAME_APPEND8(ctrl);
+# endif
+#endif
 }
 
-void frame_append_u16(uint16_t x)
+bool frame_reserve(uint8_t n)
 {
-	if (!frame_start_flag)
+	return frame_room(n);
+}
+
+void frame_append_u8(uint8_t x)
+{
+	if (!frame_room(sizeof(x)))
 		return;
 
-	uint8_t ih = tx.head;
-	uint8_t ih_1 = CIRC_NEXT(ih, P_SZ(tx));
-	uint8_t b_ih_1 = tx.p_idx[ih_1];
+	FRAME_APPEND8(x);
+}
 
-	/* Can we advance our packet bytes? if not, drop packet */
-	if (CIRC_SPACE(b_ih_1, tx.p_idx[tx.tail], B_SZ(tx))
-			< (sizeof(uint16_t) + FRAME_CRC_SZ)) {
-		FRAME_DROP(tx, ih_1, ih);
+void frame_append_u16(uint16_t x)
+{
+	if (!frame_room(sizeof(x)))
 		return;
-	}
 
-	PBUF_APPEND16(tx, x);
+	FRAME_APPEND8((uint8_t)(x >> 8));
+	FRAME_APPEND8((uint8_t)(x & 0xff));
+}
+
+void frame_append_u32(uint32_t x)
+{
+	if (!frame_room(sizeof(x)))
+		return;
 
-	frame_crc_temp = _crc_ccitt_update(frame_crc_temp, (uint8_t)(x >> 8));
-	frame_crc_temp = _crc_ccitt_update(frame_crc_temp, (uint8_t)(x & 0xFF));
+	FRAME_APPEND8((uint8_t)(x >> 24));
+	FRAME_APPEND8((uint8_t)(x >> 16));
+	FRAME_APPEND8((uint8_t)(x >> 8));
+	FRAME_APPEND8((uint8_t)(x & 0xff));
 }
 
+void frame_append_block(const void *data, uint8_t nbytes)
+{
+	if (!frame_room(nbytes))
+		return;
+
+	const uint8_t *d = data;
+	uint8_t i;
+	for (i = 0; i < nbytes; i++)
+		FRAME_APPEND8(d[i]);
+}
 
 void frame_done(void)
 {
@@ -584,7 +1182,15 @@ void frame_done(void)
 		return;
 	frame_start_flag = false;
 
-	PBUF_APPEND16(tx, frame_crc_temp);
+	/* the crc goes out low byte first, as in frame_send */
+#ifdef FRAME_COBS
+	frame_crc_temp ^= FRAME_CRC_XOR;
+	FRAME_PUT8(frame_crc_temp & 0xff);
+	FRAME_PUT8(frame_crc_temp >> 8);
+	tx.buf[frame_cobs_code] = frame_cobs_run + 1;
+#else
+	PBUF_APPEND16(tx, htons(frame_crc_temp));
+#endif
 
 	uint8_t ih = tx.head;
 	uint8_t ih_1 = CIRC_NEXT(ih, P_SZ(tx));
@@ -592,6 +1198,8 @@ void frame_done(void)
 
 	tx.p_idx[ih_2] = tx.p_idx[ih_1];
 
+	HWM_UPDATE(tx, ih_1, hwm.tx_bytes, hwm.tx_pkts);
+
 	/* XXX: this barrier may not be needed as all necisary updates to
 	 * tx.p_idx[ih_1] are done in previous functions */
 	barrier();
@@ -600,119 +1208,346 @@ void frame_done(void)
 }
 
 
-void frame_send(const void *data, uint8_t nbytes)
-{
-	uint8_t ih = tx.head;
-	uint8_t b_ih = tx.p_idx[ih];
-	uint8_t it = tx.tail;
-	uint8_t b_it = tx.p_idx[it];
+/*
+ * The body of a frame_send(), stored from b_ih on:
+ *   TX_BODY_START, the header (TX_ADDR_PUT, TX_CTRL_PUT), TX_DATA_PUT,
+ *   TX_CRC_PUT, TX_BODY_END
+ * With FRAME_COBS each byte is encoded on the way (TX_COBS_PUT8) and
+ * TX_BODY_START declares cobs_code and cobs_run for it.
+ */
+#ifdef FRAME_COBS
+# define TX_BODY_START(circ, b_ih)					\
+	uint8_t cobs_code = b_ih;					\
+	uint8_t cobs_run = 0;						\
+	b_ih = CIRC_NEXT(b_ih, B_SZ(circ))
+
+# define TX_RAW8(circ, b_ih, x) do {					\
+	uint8_t x_ = (x);						\
+	TX_COBS_PUT8(circ, b_ih, cobs_code, cobs_run, x_);		\
+} while(0)
 
-	dbgprintf_pbuf(DBG_TX_MAIN, tx, "FRAME_SEND:");
+# define TX_DATA_PUT(circ, b_ih, b_it, crc, data, nbytes) do {		\
+	uint8_t i;							\
+	for (i = 0; i < nbytes; i++)					\
+		TX_PUT8(circ, b_ih, crc, ((uint8_t *)data)[i]);		\
+} while(0)
 
-	/* we can fill .buf up completely only in the case that the packet
-	 * buffer has more than 1 packet (which is very likely), so use
-	 * the standard circ buffer managment here to keep the space open */
-	uint8_t space = CIRC_SPACE(b_ih, b_it, B_SZ(tx));
+# define TX_BODY_END(circ) ((circ).buf[cobs_code] = cobs_run + 1)
+#else
+# define TX_BODY_START(circ, b_ih) do {} while(0)
 
-	/* Can we advance our packet bytes? if not, drop packet */
-	if ((nbytes + FRAME_CRC_SZ) > space) {
-		dbgprintf(DBG_TX_MAIN,
-				"\tb space nbytes(%d) + CRC_SZ(%d) > space(%d)",
-				nbytes, FRAME_CRC_SZ, space);
-		return;
-	}
+# define TX_RAW8(circ, b_ih, x) do {					\
+	(circ).buf[b_ih] = (x);						\
+	b_ih = CIRC_NEXT(b_ih, B_SZ(circ));				\
+} while(0)
 
-	uint8_t ih_1 = CIRC_NEXT(ih, P_SZ(tx));
-	dbgprintf(DBG_TX_MAIN, "\tih_1 = %d\n", ih_1);
-	/* do we have space for the packet_idx? */
-	if (ih_1 == it) {
-		dbgprintf(DBG_TX_MAIN,
-				"\ti space ih_1(%d) == it(%d)", ih_1, it);
-		return;
-	}
+# define TX_DATA_PUT(circ, b_ih, b_it, crc, data, nbytes) do {		\
+	/* crc calculation */						\
+	uint8_t i;							\
+	for (i = 0; i < nbytes; i++) {					\
+		crc = _crc_ccitt_update(crc,				\
+				((uint8_t *)data)[i]);			\
+	}								\
+									\
+	/* amount to copy in first memcpy */				\
+	uint8_t space_to_end =						\
+		MIN(CIRC_SPACE_TO_END(b_ih, b_it, B_SZ(circ)),		\
+				nbytes);				\
+									\
+	/* copy first segment of data (may be split) */			\
+	memcpy((circ).buf + b_ih, data, space_to_end);			\
+									\
+	/* copy second segment if it exsists (nbytes - space_to_end	\
+	 * == 0 when it doesn't) */					\
+	memcpy((circ).buf, data + space_to_end, nbytes - space_to_end);	\
+									\
+	b_ih = (b_ih + nbytes) & (B_SZ(circ) - 1);			\
+} while(0)
 
-	uint16_t crc = FRAME_CRC_INIT;
-	{
-		/* crc calculation */
-		uint8_t i;
-		for (i = 0; i < nbytes; i++) {
-			crc = _crc_ccitt_update(crc, ((uint8_t *)data)[i]);
-		}
-	}
+# define TX_BODY_END(circ) do {} while(0)
+#endif
 
-	/* amount to copy in first memcpy */
-	uint8_t space_to_end =
-		MIN(CIRC_SPACE_TO_END(b_ih, b_it, B_SZ(tx)),
-				nbytes);
+/* the header goes in front of the data, and into the crc */
+#define TX_PUT8(circ, b_ih, crc, x) do {				\
+	crc = _crc_ccitt_update(crc, (x));				\
+	TX_RAW8(circ, b_ih, (x));					\
+} while(0)
 
-	/* copy first segment of data (may be split) */
-	memcpy(tx.buf + b_ih, data, space_to_end);
+/* the crc goes out low byte first */
+#define TX_CRC_PUT(circ, b_ih, crc) do {				\
+	uint16_t c_ = (crc) ^ FRAME_CRC_XOR;				\
+	TX_RAW8(circ, b_ih, c_ & 0xff);					\
+	TX_RAW8(circ, b_ih, c_ >> 8);					\
+} while(0)
 
-	/* copy second segment if it exsists (nbytes - space_to_end == 0
-	 * when it doesn't) */
-	memcpy(tx.buf, data + space_to_end, nbytes - space_to_end);
+#ifdef FRAME_NODE
+# define TX_ADDR_PUT(circ, b_ih, crc) \
+	TX_PUT8(circ, b_ih, crc, FRAME_ADDR_SELF)
+#else
+# define TX_ADDR_PUT(circ, b_ih, crc) do {} while(0)
+#endif
 
-	/* advance packet length */
-	tx.p_idx[ih_1] = (b_ih + nbytes) & (B_SZ(tx) - 1);
+#ifdef FRAME_SEQ
+/* ctrl: a FRAME_CTRL_*, or TX_CTRL_I for the next I frame. Only numbered
+ * once the frame is sure to be queued. */
+# define TX_CTRL_I 0xff
+# define TX_CTRL_PUT(circ, b_ih, crc, ctrl) do {			\
+	uint8_t c_ = (ctrl) == TX_CTRL_I ? seq_ctrl_i() : (ctrl);	\
+	TX_PUT8(circ, b_ih, crc, c_);					\
+} while(0)
+# define FRAME_SEND_PROTO(name) \
+	static void name##_c(uint8_t ctrl, const void *data, uint8_t nbytes)
+#else
+# define TX_CTRL_PUT(circ, b_ih, crc, ctrl) do {} while(0)
+# define FRAME_SEND_PROTO(name) \
+	void name(const void *data, uint8_t nbytes)
+#endif
 
-	dbgprintf_pbuf(DBG_TX_MAIN, tx, "\t BEFORE append:");
-	PBUF_APPEND16(tx, htons(crc));
-	dbgprintf_pbuf(DBG_TX_MAIN, tx, "\t AFTER append:");
+/*
+ * FRAME_SEND_FN - define a frame_send() style function queueing onto @circ.
+ *                 With FRAME_SEQ, it is name##_c() and takes the control
+ *                 byte first.
+ *
+ * @hwm_update: statement run once the frame is in place, before it is made
+ *              visible to the tx isr (ih_1 is the new head).
+ */
+#define FRAME_SEND_FN(name, circ, hwm_update)				\
+FRAME_SEND_PROTO(name)							\
+{									\
+	uint8_t ih = (circ).head;					\
+	uint8_t b_ih = (circ).p_idx[ih];				\
+	uint8_t it = (circ).tail;					\
+	uint8_t b_it = (circ).p_idx[it];				\
+									\
+	dbgprintf_pbuf(DBG_TX_MAIN, circ, "FRAME_SEND:");		\
+									\
+	/* we can fill .buf up completely only in the case that the	\
+	 * packet buffer has more than 1 packet (which is very likely),	\
+	 * so use the standard circ buffer managment here to keep the	\
+	 * space open */						\
+	uint8_t space = CIRC_SPACE(b_ih, b_it, B_SZ(circ));		\
+									\
+	/* Can we advance our packet bytes? if not, drop packet */	\
+	if ((nbytes + FRAME_HDR_SZ + FRAME_CRC_SZ + TX_COBS_SZ) > space) { \
+		dbgprintf(DBG_TX_MAIN,					\
+			"\tb space nbytes(%d) + CRC_SZ(%d) > space(%d)", \
+				nbytes, FRAME_CRC_SZ, space);		\
+		STAT_INC(stats.tx_full);				\
+		return;							\
+	}								\
+									\
+	uint8_t ih_1 = CIRC_NEXT(ih, P_SZ(circ));			\
+	dbgprintf(DBG_TX_MAIN, "\tih_1 = %d\n", ih_1);			\
+	/* do we have space for the packet_idx? */			\
+	if (ih_1 == it) {						\
+		dbgprintf(DBG_TX_MAIN,					\
+			"\ti space ih_1(%d) == it(%d)", ih_1, it);	\
+		STAT_INC(stats.tx_full);				\
+		return;							\
+	}								\
+									\
+	uint16_t crc = FRAME_CRC_INIT;					\
+	TX_BODY_START(circ, b_ih);					\
+	TX_ADDR_PUT(circ, b_ih, crc);					\
+	TX_CTRL_PUT(circ, b_ih, crc, ctrl);				\
+	TX_DATA_PUT(circ, b_ih, b_it, crc, data, nbytes);		\
+	TX_CRC_PUT(circ, b_ih, crc);					\
+	TX_BODY_END(circ);						\
+									\
+	/* advance packet length */					\
+	(circ).p_idx[ih_1] = b_ih;					\
+	dbgprintf_pbuf(DBG_TX_MAIN, circ, "\t AFTER append:");		\
+									\
+	/* update the next I for future packet writes. */		\
+	uint8_t ih_2 = CIRC_NEXT(ih_1, P_SZ(circ));			\
+	(circ).p_idx[ih_2] = (circ).p_idx[ih_1];			\
+									\
+	hwm_update;							\
+									\
+	/* advance packet idx */					\
+	/* XXX: if we usart0_udre_lock() prior to setting the head,	\
+	 * the error check in the ISR for an empty packet can be	\
+	 * avoided. As we know that the currently inserted data will	\
+	 * not have been processed, while without the locking if the	\
+	 * added packet is short enough and the ISR is unlocked when we	\
+	 * set the head, the ISR may be able to process the entire	\
+	 * added packet and disable itself prior to us calling		\
+	 * usart0_udre_unlock().					\
+	 */								\
+	barrier();							\
+	(circ).head = ih_1;						\
+									\
+	/* new packet starts from p_idx[next_i_head] */			\
+	dbgprintf(DBG_TX_MAIN, "\tudre_unlock");			\
+	dbgflush(DBG_TX_MAIN);						\
+	usart0_udre_unlock();						\
+	dbgprintf(DBG_TX_MAIN, "\tdone\n");				\
+	dbgflush(DBG_TX_MAIN);						\
+}
 
-	/* update the next I for future packet writes. */
-	uint8_t ih_2 = CIRC_NEXT(ih_1, P_SZ(tx));
-	tx.p_idx[ih_2] = tx.p_idx[ih_1];
+FRAME_SEND_FN(frame_send, tx,
+		HWM_UPDATE(tx, ih_1, hwm.tx_bytes, hwm.tx_pkts))
 
-	/* advance packet idx */
-	/* XXX: if we usart0_udre_lock() prior to setting tx.head,
-	 * the error check in the ISR for an empty packet can be avoided.
-	 * As we know that the currently inserted data will not have been
-	 * processed, while without the locking if the added packet is short
-	 * enough and the ISR is unlocked when we set tx.head, the ISR may be
-	 * able to process the entire added packet and disable itself prior
-	 * to us calling usart0_udre_unlock().
-	 */
-	barrier();
-	tx.head = ih_1;
+FRAME_SEND_FN(frame_send_urgent, txu,
+		HWM_UPDATE(txu, ih_1, hwm.txu_bytes, hwm.txu_pkts))
 
-	/* new packet starts from tx.p_idx[next_i_head] */
-	dbgprintf(DBG_TX_MAIN, "\tudre_unlock");
-	dbgflush(DBG_TX_MAIN);
-	usart0_udre_unlock();
-	dbgprintf(DBG_TX_MAIN, "\tdone\n");
-	dbgflush(DBG_TX_MAIN);
+#ifdef FRAME_SEQ
+void frame_send(const void *data, uint8_t nbytes)
+{
+	frame_send_c(TX_CTRL_I, data, nbytes);
 }
 
+void frame_send_urgent(const void *data, uint8_t nbytes)
+{
+	frame_send_urgent_c(FRAME_CTRL_UI, data, nbytes);
+}
 
-/*** Initialization ***/
+/* a frame of only a header. In the tx ring, behind the I frames already
+ * there, so N(R)s reach the host in order. */
+static void frame_send_ctrl(uint8_t ctrl)
+{
+	frame_send_c(ctrl, &ctrl, 0);
+}
+#endif
+
+bool frame_tx_busy(void)
+{
+	/* unlocked: the tx isr only ever empties the ring, so at worst this
+	 * is behind by a byte or a frame */
+	uint8_t ih = tx.head;
+	uint8_t bytes = CIRC_CNT(tx.p_idx[ih], tx.p_idx[tx.tail], B_SZ(tx));
+	uint8_t pkts = CIRC_CNT(ih, tx.tail, P_SZ(tx));
+	return bytes > B_SZ(tx) / 2 || pkts > P_SZ(tx) / 2;
+}
+
+/*** Statistics ***/
+void frame_hwm_get(struct frame_hwm *h, bool reset)
+{
+	usart0_rx_lock();
+	*h = hwm;
+	if (reset)
+		memset(&hwm, 0, sizeof(hwm));
+	usart0_rx_unlock();
+}
+
+void frame_stats_get(struct frame_stats *st, bool reset)
+{
+	/* the rx isr updates some of these, and 16 bit accesses are not
+	 * atomic. */
+	usart0_rx_lock();
+	*st = stats;
+	if (reset)
+		memset(&stats, 0, sizeof(stats));
+	usart0_rx_unlock();
+}
+
+#ifdef FRAME_CREDIT
+void frame_credit_get(struct frame_credit *c)
+{
+	usart0_rx_lock();
+	c->seen = credit_seen;
+#ifdef FRAME_RX_LPQ
+	/* each packet needs a length byte, one is kept for the next */
+	c->free_pkts = UINT8_MAX;
+	c->free_bytes = RXQ_SZ - 1 - CIRC_CNT(rx.head, rx.tail, RXQ_SZ);
+#else
+	/* the frame being received is not counted, it is not seen yet */
+	c->free_pkts = P_SZ(rx) - 2 - rxq_ct();
+	c->free_bytes = B_SZ(rx) - 1 - CIRC_CNT(rx.p_idx[rx.head],
+			rx.p_idx[rx.tail], B_SZ(rx));
+#endif
+	usart0_rx_unlock();
+	credit_freed = 0;
+}
+
+bool frame_credit_due(void)
+{
+	return credit_freed
+		&& (rxq_empty() || credit_freed >= FRAME_CREDIT_STEP);
+}
+#endif
+
+/*** Line settings ***/
 #ifdef AVR
-static void usart0_init(void)
+/* how far the rate made may be off the one asked for, in thousandths. The
+ * receiver samples each bit mid-way, so the two ends' errors together have
+ * to stay under about 4% over the 11 bits of a char; take a bit over half
+ * for ours, which lets 115200 (+2.1% at 16MHz) through. */
+# ifndef FRAME_LINE_ERR_MAX
+#  define FRAME_LINE_ERR_MAX 25
+# endif
+
+/* the rate at reset, as setbaud.h makes it */
+# define BAUD FRAME_LINE_BAUD
+# include <util/setbaud.h>
+
+/* other rates are made with U2X, which reaches F_CPU / 8 (2M at 16MHz) */
+# define LINE_UBRR_2X(baud) ((F_CPU + 4 * (baud)) / (8 * (baud)) - 1)
+# define LINE_BAUD_2X(ubrr) (F_CPU / (8 * ((uint32_t)(ubrr) + 1)))
+
+static struct frame_line line = {
+	.baud = FRAME_LINE_BAUD,
+	.parity = FRAME_LINE_PARITY,
+};
+
+static void usart0_conf(uint16_t ubrr, bool u2x, bool parity)
 {
-	power_usart0_enable();
 	/* Disable ISRs, recv, and trans */
 	UCSR0B = 0;
 
-	/* Asyncronous, parity odd, 1 bit stop, 8 bit data */
+	/* Asyncronous, parity odd (or none), 1 bit stop, 8 bit data */
 	UCSR0C = (0 << UMSEL01) | (0 << UMSEL00)
-		| (1 << UPM01)  | (1 << UPM00)
+		| (parity << UPM01) | (parity << UPM00)
 		| (0 << USBS0)
 		| (1 << UCSZ01) | (1 << UCSZ00);
 
-	/* Baud 38400 */
-# define BAUD 57600
-# include <util/setbaud.h>
-	UBRR0 = UBRR_VALUE;
-
-# if USE_2X
-	UCSR0A = (1 << U2X0);
-# else
-	UCSR0A = 0;
-# endif
+	UBRR0 = ubrr;
+	UCSR0A = u2x << U2X0;
 
 	/* Enable RX isr, disable UDRE isr, EN recv and trans, 8 bit data */
 	UCSR0B = (1 << RXCIE0) | (0 << UDRIE0)
 		| (1 << RXEN0) | (1 << TXEN0)
 		| (0 << UCSZ02);
+}
+
+void frame_line_get(struct frame_line *l)
+{
+	*l = line;
+}
+
+bool frame_line_ok(uint32_t baud)
+{
+	if (baud < LINE_BAUD_2X(4095) || baud > LINE_BAUD_2X(0))
+		return false;
+
+	uint32_t made = LINE_BAUD_2X(LINE_UBRR_2X(baud));
+	uint32_t off = made > baud ? made - baud : baud - made;
+	return off * 1000 / baud <= FRAME_LINE_ERR_MAX;
+}
+
+void frame_line_set(const struct frame_line *l)
+{
+	/* the tx isr turns itself off once the rings are empty, after which
+	 * the last char may still be in UDR0 and another in the shift
+	 * register: give them 2 char times (of 11 bits) to leave. */
+	loop_until_bit_is_clear(UCSR0B, UDRIE0);
+	uint16_t us = 22000000 / line.baud + 1;
+	while (us--)
+		_delay_us(1);
+
+	line = *l;
+	if (line.baud == FRAME_LINE_BAUD) {
+		usart0_conf(UBRR_VALUE, USE_2X, line.parity);
+	} else {
+		usart0_conf(LINE_UBRR_2X(line.baud), true, line.parity);
+	}
+}
+
+/*** Initialization ***/
+static void usart0_init(void)
+{
+	power_usart0_enable();
+	usart0_conf(UBRR_VALUE, USE_2X, FRAME_LINE_PARITY);
 
 	/* XXX: debugging */
 # if DBG_MASK
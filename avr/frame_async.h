@@ -14,6 +14,10 @@ void frame_timeout(void);
 /* For simulating interrupts on non-avr hardware */
 void frame_tx_isr(void);
 void frame_rx_isr(void);
+/* true while the tx isr would be enabled */
+extern bool frame_udre_ie;
+/* bytes of ram taken by the receive queue */
+extern const uint16_t frame_rx_ram;
 #endif
 
 /*** Transmision ***/
@@ -26,9 +30,16 @@ void frame_rx_isr(void);
 /* begin construction of a packet */
 void frame_start(void);
 
-/* various appends */
+/* check that nbytes more may be appended, dropping the packet if not.
+ * return: true if the following appends (of up to nbytes) will succeed.
+ */
+bool frame_reserve(uint8_t nbytes);
+
+/* various appends, multibyte values are sent in network byte order */
 void frame_append_u8(uint8_t n);
 void frame_append_u16(uint16_t n);
+void frame_append_u32(uint32_t n);
+void frame_append_block(const void *data, uint8_t nbytes);
 
 /* dispatch the constructed packet */
 void frame_done(void);
@@ -36,6 +47,16 @@ void frame_done(void);
 /** Full Packet transmit **/
 void frame_send(const void *data, uint8_t nbytes);
 
+/* as frame_send, but into a small ring of its own which the tx isr drains
+ * first (between frames). For errors and timeouts, which should neither
+ * wait behind nor be crowded out by telemetry. */
+void frame_send_urgent(const void *data, uint8_t nbytes);
+
+/* return: true when the tx ring is over half full, in bytes or frames. For
+ * senders of telemetry, which would rather skip a sample than queue it
+ * behind others. */
+bool frame_tx_busy(void);
+
 /*** Reception ***/
 
 /* 2 paths possible for recviever:
@@ -46,6 +67,9 @@ void frame_send(const void *data, uint8_t nbytes);
  *    frame_recv_{copy,byte} calls to get all the data.
  * Once done recieving current packet, call frame_recv_next to advance to the
  * next packet. Packets *are not* advanced automatically under any condition.
+ *
+ * The crc of a packet is checked (outside of the rx isr) by whichever of
+ * these first looks at it, packets which fail are silently discarded.
  */
 
 /* dst: array of at least len bytes into which the current packet is copied
@@ -71,6 +95,20 @@ uint8_t frame_recv_len(void);
  */
 uint8_t frame_recv_byte(void);
 
+/* a run of contiguous bytes of a received packet */
+struct frame_seg {
+	uint8_t *p;
+	uint8_t len;
+};
+
+/* seg: filled with the unread bytes of the current packet, which are
+ *      contiguous in the receive buffer unless they wrap around its end.
+ * return: the number of segments used, 0 when there is no packet.
+ * the byte pointer is not advanced, the segments remain valid until
+ * frame_recv_next.
+ */
+uint8_t frame_recv_peek(struct frame_seg seg[2]);
+
 /* advance the packet pointer to the next packet.
  *
  * One must be sure the packet queue is not empty prior to calling this func.
@@ -88,8 +126,83 @@ void frame_recv_next(void);
 bool frame_recv_have_pkt(void);
 
 /* return: the number of packets presently in the queue. The queue includes
- *         the packet currently being processed.
+ *         the packet currently being processed, and packets whose crc has
+ *         not been checked yet.
  */
 uint8_t frame_recv_ct(void);
 
+/*** Line settings ***/
+
+struct frame_line {
+	uint32_t baud;
+	bool parity;		/* odd, or none */
+};
+
+/* l: filled with the present settings */
+void frame_line_get(struct frame_line *l);
+
+/* return: true if the usart can make @baud closely enough to be understood
+ *         (within FRAME_LINE_ERR_MAX) */
+bool frame_line_ok(uint32_t baud);
+
+/* wait for every frame queued so far to go out at the present settings,
+ * then switch to @l. A frame being received is lost. @l->baud must pass
+ * frame_line_ok(). */
+void frame_line_set(const struct frame_line *l);
+
+/*** Statistics ***/
+
+/* the most bytes (crc included, escapes excluded) and packets held at once
+ * by each ring since the last reset */
+struct frame_hwm {
+	uint8_t rx_bytes;
+	uint8_t rx_pkts;
+	uint8_t tx_bytes;
+	uint8_t tx_pkts;
+	uint8_t txu_bytes;	/* the urgent ring */
+	uint8_t txu_pkts;
+};
+
+/* h: filled with the present high water marks.
+ * reset: start tracking again from zero.
+ */
+void frame_hwm_get(struct frame_hwm *h, bool reset);
+
+/* frames dropped, by cause. Each count sticks at UINT16_MAX. */
+struct frame_stats {
+	uint16_t rx_frame_err;	/* usart framing error */
+	uint16_t rx_overrun;	/* usart data overrun */
+	uint16_t rx_parity;	/* usart parity error */
+	uint16_t rx_crc;	/* bad crc, or too short to have one */
+	uint16_t rx_pkt_full;	/* no free packet slot */
+	uint16_t rx_buf_full;	/* no room in the byte ring */
+	uint16_t rx_abort;	/* FRAME_RESET from the sender */
+	uint16_t tx_full;	/* no room to queue an outgoing frame */
+};
+
+/* st: filled with the present counts.
+ * reset: zero the counts.
+ */
+void frame_stats_get(struct frame_stats *st, bool reset);
+
+/*** Flow control (FRAME_CREDIT) ***/
+
+/* room left in the receive queue, for the sender to pace itself by */
+struct frame_credit {
+	uint8_t seen;		/* frames the rx isr has finished with,
+				 * queued or dropped. wraps. */
+	uint8_t free_pkts;	/* more which may be queued, UINT8_MAX when
+				 * only bytes limit it */
+	uint8_t free_bytes;	/* each taking its length (crc included)
+				 * plus one */
+};
+
+/* c: filled with the present room. Clears frame_credit_due(). */
+void frame_credit_get(struct frame_credit *c);
+
+/* return: true when frames have been freed since the last
+ *         frame_credit_get(), and either the queue has emptied or
+ *         FRAME_CREDIT_STEP of them have. */
+bool frame_credit_due(void);
+
 #endif
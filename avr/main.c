@@ -19,6 +19,7 @@
 #include "error_frame.h"
 
 #include "../hj_proto.h"
+#include <frame/frame_proto.h>
 
 #define MCTRL_PID
 
@@ -92,14 +93,6 @@ static void enc_init(void)
 	barrier();			\
 } while(0)
 
-static void enc_get(struct hj_pktc_enc *e, uint8_t i)
-{
-	enc_isr_off();
-	e->p = htonl(enc_data[i].ct_p);
-	e->n = htonl(enc_data[i].ct_n);
-	e->l = htons(enc_data[i].ct_local);
-	enc_isr_on();
-}
 
 #define enc_update(e, pin, xpin) do {				\
 	uint8_t pa_ = (e).a;					\
@@ -132,12 +125,129 @@ ISR(ENC_ISR)
 }
 
 
-static void motor_info_get(struct hj_pktc_motor_info *m, uint16_t current,
-		uint8_t i)
+/* the contents of a struct hj_pktc_motor_info, in host order */
+struct motor_snap {
+	uint16_t current;
+	uint32_t p;
+	uint32_t n;
+	int16_t  l;
+	int16_t  pwr;
+	int16_t  vel;
+};
+
+static void motor_snap_get(struct motor_snap *s, uint16_t current, uint8_t i)
+{
+	s->current = current;
+
+	enc_isr_off();
+	s->p = enc_data[i].ct_p;
+	s->n = enc_data[i].ct_n;
+	s->l = enc_data[i].ct_local;
+	enc_isr_on();
+
+	s->pwr = motor_pwr[i];
+	/* vel */
+	s->vel = 0;
+}
+
+/* append the @fields (HJ_FIELD_*) of a struct hj_pktc_motor_info to the
+ * frame being built */
+static void motor_fields_append(const struct motor_snap *s, uint8_t fields)
+{
+	if (fields & HJ_FIELD_CURRENT)
+		frame_append_u16(s->current);
+	if (fields & HJ_FIELD_P)
+		frame_append_u32(s->p);
+	if (fields & HJ_FIELD_N)
+		frame_append_u32(s->n);
+	if (fields & HJ_FIELD_L)
+		frame_append_u16(s->l);
+	if (fields & HJ_FIELD_PWR)
+		frame_append_u16(s->pwr);
+	if (fields & HJ_FIELD_VEL)
+		frame_append_u16(s->vel);
+}
+
+#define motor_info_append(s) motor_fields_append(s, HJ_FIELD_ALL)
+
+/*
+ * Snapshots sent in HJA_PT_INFO_DELTA, by seq % HJ_DELTA_HIST. A slot
+ * holds the snapshot seq names only until it is reused, so the host's ack
+ * is checked against the seq kept with it.
+ */
+static struct {
+	struct motor_snap m[2];
+	uint8_t seq;
+	bool used;
+} delta_hist[HJ_DELTA_HIST];
+static uint8_t delta_seq;
+static uint8_t delta_since_key;
+
+static void delta_append(int32_t d)
 {
-	m->current = htons(current);
-	m->pwr = htons(motor_pwr[i]);
-	enc_get(&m->e, i);
+	uint32_t u = HJ_ZIGZAG(d);
+	while (u >= HJ_VARINT_MORE) {
+		frame_append_u8(u | HJ_VARINT_MORE);
+		u >>= 7;
+	}
+	frame_append_u8(u);
+}
+
+/* each difference is taken in the width of its field */
+#define delta_append16(c, b) delta_append((int16_t)((c) - (b)))
+#define delta_append32(c, b) delta_append((int32_t)((c) - (b)))
+
+static void motor_delta_append(const struct motor_snap *s,
+		const struct motor_snap *b)
+{
+	delta_append16(s->current, b->current);
+	delta_append32(s->p, b->p);
+	delta_append32(s->n, b->n);
+	delta_append16(s->l, b->l);
+	delta_append16(s->pwr, b->pwr);
+	delta_append16(s->vel, b->vel);
+}
+
+/* build a HJA_PT_INFO_DELTA directly in the tx ring */
+static void info_delta_send(struct hjb_pkt_req_info_delta *req,
+		uint16_t current[2])
+{
+	static const struct motor_snap zero[2];
+	uint8_t seq = delta_seq;
+	uint8_t base = seq;
+	const struct motor_snap *b = zero;
+
+	frame_start();
+	if (!frame_reserve(HJA_PL_INFO_DELTA))
+		return;
+
+	if (!(req->flags & HJB_INFO_DELTA_KEY)
+			&& delta_since_key < HJ_DELTA_KEY_EVERY - 1) {
+		uint8_t a = req->ack % HJ_DELTA_HIST;
+		if (delta_hist[a].used && delta_hist[a].seq == req->ack) {
+			base = req->ack;
+			b = delta_hist[a].m;
+		}
+	}
+
+	/* the slot being filled may be the base, so snap to the side */
+	struct motor_snap s[2];
+	motor_snap_get(&s[0], current[0], 0);
+	motor_snap_get(&s[1], current[1], 1);
+
+	frame_append_u8(HJA_PT_INFO_DELTA);
+	frame_append_u8(seq);
+	frame_append_u8(base);
+	motor_delta_append(&s[0], &b[0]);
+	motor_delta_append(&s[1], &b[1]);
+	frame_done();
+
+	uint8_t h = seq % HJ_DELTA_HIST;
+	memcpy(delta_hist[h].m, s, sizeof(s));
+	delta_hist[h].seq = seq;
+	delta_hist[h].used = true;
+	delta_seq = seq + 1;
+	delta_since_key = base == seq ? 0 : delta_since_key + 1;
 }
 
 /* update_pwr - called when the output pwm signal to a motor changes
@@ -191,13 +301,89 @@ static void pid_tmr_init(void)
 	TIMER2_INIT_CTC(TIMER2_PSC_1024, 0xff);
 }
 
+/*
+ * The clock (HJ_CLOCK_US): the PID timer's ticks, counted by its isr, and
+ * its count within the tick. The compare match (and so the isr) comes as
+ * the count reaches OCR2A (0xff), and the count clears on the next, so a
+ * tick is taken to begin at 0xff.
+ */
+static uint32_t clock_ticks;
+
+static uint32_t clock_now(void)
+{
+	uint32_t t;
+	uint8_t c;
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+		t = clock_ticks;
+		c = TCNT2 + 1;
+		/* the tick has begun, but its isr is held off */
+		if ((TIFR2 & (1 << OCF2A)) && c < 0x80)
+			t++;
+	}
+	return (t << 8) | c;
+}
+
 #define pid_step(m_idx) do {							\
 	update_pwr(m_idx, pid_update(&mpid[m_idx], enc_data[m_idx].ct_local));	\
 	enc_data[m_idx].ct_local = 0;						\
 } while(0)
 
+/*
+ * Streamed samples (HJB_PT_SUBSCRIBE). The timer isr takes them, evenly
+ * spaced, every stream_eff ticks; the main loop sends them. stream_eff is
+ * stream_period, or slower while the tx ring is busy.
+ *
+ * The main loop writes the isr's side with the timer off. It is the only
+ * writer of stream_period and stream_eff, so reads them freely.
+ */
+#define STREAM_CALM 8	/* samples sent unhindered before speeding up */
+
+static uint8_t stream_period;
+static uint8_t stream_eff;
+static uint8_t stream_tick;
+static uint8_t stream_calm;
+static volatile bool stream_due;
+static struct motor_snap stream_snap[2];
+static uint32_t stream_snap_time;
+static uint8_t stream_snap_period;
+static uint8_t stream_skipped;
+
+static void stream_skip_inc(void)
+{
+	if (stream_skipped < UINT8_MAX)
+		stream_skipped++;
+}
+
+/* from the timer isr, before the pid step clears ct_local */
+static inline void stream_sample(void)
+{
+	if (!stream_eff || ++stream_tick < stream_eff)
+		return;
+
+	/* the last was never sent */
+	if (stream_due)
+		stream_skip_inc();
+
+	uint8_t i;
+	for (i = 0; i < 2; i++) {
+		struct motor_snap *s = &stream_snap[i];
+		s->p = enc_data[i].ct_p;
+		s->n = enc_data[i].ct_n;
+		s->l = enc_data[i].ct_local;
+		s->pwr = motor_pwr[i];
+		s->vel = 0;
+	}
+
+	stream_snap_time = clock_ticks << 8;
+	stream_snap_period = stream_eff;
+	stream_tick = 0;
+	stream_due = true;
+}
+
 ISR(TIMER2_COMPA_vect)
 {
+	clock_ticks++;
+	stream_sample();
 	pid_step(0);
 	pid_step(1);
 }
@@ -237,21 +423,172 @@ static void pid_k_store_all(void)
 	pid_k_store(1);
 }
 
+static void stream_start(uint8_t period)
+{
+	pid_tmr_off();
+	/* repeated to keep it going, which should not undo a slow down */
+	if (period != stream_period) {
+		stream_period = period;
+		stream_eff = period;
+		stream_tick = 0;
+		stream_calm = 0;
+	}
+	if (!period)
+		stream_due = false;
+	pid_tmr_on();
+}
+
+static void stream_skip(void)
+{
+	pid_tmr_off();
+	stream_skip_inc();
+	pid_tmr_on();
+}
+
+static void stream_send(void)
+{
+	struct motor_snap s[2];
+	uint32_t time;
+	uint8_t period, skipped;
+
+	pid_tmr_off();
+	memcpy(s, stream_snap, sizeof(s));
+	time = stream_snap_time;
+	period = stream_snap_period;
+	skipped = stream_skipped;
+	stream_due = false;
+	pid_tmr_on();
+
+	if (frame_tx_busy()) {
+		pid_tmr_off();
+		stream_eff = stream_eff > UINT8_MAX / 2
+			? UINT8_MAX : stream_eff * 2;
+		stream_skip_inc();
+		pid_tmr_on();
+		stream_calm = 0;
+		return;
+	}
+
+	uint16_t vals[ADC_CHANNEL_CT];
+	adc_val_cpy(vals);
+	s[0].current = vals[0];
+	s[1].current = vals[1];
+
+	frame_start();
+	if (!frame_reserve(HJA_PL_STREAM)) {
+		stream_skip();
+		return;
+	}
+
+	frame_append_u8(HJA_PT_STREAM);
+	frame_append_u8(period);
+	frame_append_u8(skipped);
+	frame_append_u32(time);
+	motor_info_append(&s[0]);
+	motor_info_append(&s[1]);
+	frame_done();
+
+	pid_tmr_off();
+	stream_skipped -= skipped;
+	pid_tmr_on();
+
+	if (stream_eff > stream_period && ++stream_calm >= STREAM_CALM) {
+		pid_tmr_off();
+		stream_eff /= 2;
+		if (stream_eff < stream_period)
+			stream_eff = stream_period;
+		pid_tmr_on();
+		stream_calm = 0;
+	}
+}
+
 #endif /* MCTRL_PID */
 
 
 
-static void update_vel(struct hjb_pkt_set_speed *pkt)
+/* @s: if not NULL, filled with the motors' state as of the change (but
+ *     for current) */
+static void update_vel(int16_t v0, int16_t v1, struct motor_snap s[2])
 {
 #ifdef MCTRL_PID
 	pid_tmr_off();
-	pid_set_goal(mpid[0], ntohs(pkt->vel[0]));
-	pid_set_goal(mpid[1], ntohs(pkt->vel[1]));
-	pid_tmr_on();
+	pid_set_goal(mpid[0], v0);
+	pid_set_goal(mpid[1], v1);
 #else
-	update_pwr(0, ntohs(pkt->vel[0]));
-	update_pwr(1, ntohs(pkt->vel[1]));
+	update_pwr(0, v0);
+	update_pwr(1, v1);
 #endif
+	if (s) {
+		motor_snap_get(&s[0], 0, 0);
+		motor_snap_get(&s[1], 0, 1);
+	}
+#ifdef MCTRL_PID
+	pid_tmr_on();
+#endif
+}
+
+/* send a HJA_PT_INFO, built directly in the tx ring */
+static void info_send(const struct motor_snap s[2])
+{
+	frame_start();
+	if (!frame_reserve(HJA_PL_INFO))
+		return;
+
+	frame_append_u8(HJA_PT_INFO);
+	motor_info_append(&s[0]);
+	motor_info_append(&s[1]);
+	frame_done();
+}
+
+#ifdef FRAME_CREDIT
+/* urgent, so the host is not kept waiting behind telemetry */
+static void hj_send_credit(uint8_t token)
+{
+	struct frame_credit c;
+	frame_credit_get(&c);
+
+	struct hja_pkt_credit pkt = HJA_PKT_CREDIT_INITIALIZER(token, c);
+	frame_send_urgent(&pkt, HJA_PL_CREDIT);
+}
+#endif
+
+/* answer at the present settings, then switch */
+static void line_change(struct hjb_pkt_set_line *req)
+{
+	struct frame_line cur;
+	struct frame_line l = {
+		.baud = ntohl(req->baud),
+		.parity = !(req->flags & HJ_LINE_NO_PARITY),
+	};
+
+	frame_line_get(&cur);
+	if (!frame_line_ok(l.baud))
+		l = cur;
+
+	struct hja_pkt_line ack = HJA_PKT_LINE_INITIALIZER(l.baud,
+			l.parity ? 0 : HJ_LINE_NO_PARITY);
+	frame_send_urgent(&ack, HJA_PL_LINE);
+
+	/* switching drains the tx rings and resets the usart, so is not
+	 * done for nothing */
+	if (l.baud != cur.baud || l.parity != cur.parity)
+		frame_line_set(&l);
+}
+
+/* after a change, the host stops hearing us if the new settings do not
+ * work out, and goes back to those at reset; follow it. Run on every
+ * watchdog timeout, as a quiet host looks the same: hosts which move the
+ * line keep frames coming (see HJB_PT_SET_LINE in hj_proto.h). */
+static void line_fallback(void)
+{
+	struct frame_line l;
+	frame_line_get(&l);
+	if (l.baud == FRAME_LINE_BAUD && l.parity == FRAME_LINE_PARITY)
+		return;
+
+	l.baud = FRAME_LINE_BAUD;
+	l.parity = FRAME_LINE_PARITY;
+	frame_line_set(&l);
 }
 
 /** Packet Parsing. **/
@@ -274,9 +611,30 @@ static bool hj_parse(uint8_t *buf, uint8_t len)
 	struct hj_pkt_header *head = (typeof(head)) buf;
 
 	switch(head->type) {
+	case HJ_PT_ECHO:
+		if (len > HJ_PL_ECHO) {
+			hj_send_error(1);
+			return true;
+		}
+		frame_send(buf, len);
+		break;
+
 	HJ_CASE(B, SET_SPEED) {
 		struct hjb_pkt_set_speed *pkt = (typeof(pkt)) buf;
-		update_vel(pkt);
+		update_vel(ntohs(pkt->vel[0]), ntohs(pkt->vel[1]), NULL);
+		break;
+	}
+
+	HJ_CASE(B, SET_SPEED_INFO) {
+		struct hjb_pkt_set_speed_info *pkt = (typeof(pkt)) buf;
+		struct motor_snap s[2];
+		uint16_t vals[ADC_CHANNEL_CT];
+		adc_val_cpy(vals);
+
+		update_vel(ntohs(pkt->vel[0]), ntohs(pkt->vel[1]), s);
+		s[0].current = vals[0];
+		s[1].current = vals[1];
+		info_send(s);
 		break;
 	}
 
@@ -284,15 +642,101 @@ static bool hj_parse(uint8_t *buf, uint8_t len)
 		uint16_t vals[ADC_CHANNEL_CT];
 		adc_val_cpy(vals);
 
-		/* send info */
-		struct hja_pkt_info info = HJA_PKT_INFO_INITIALIZER;
+		struct motor_snap s[2];
+		motor_snap_get(&s[0], vals[0], 0);
+		motor_snap_get(&s[1], vals[1], 1);
+		info_send(s);
+		break;
+	}
+	HJ_CASE(B, REQ_FIELDS) {
+		struct hjb_pkt_req_fields *req = (typeof(req)) buf;
+#ifdef MCTRL_PID
+		uint8_t fields = req->fields & (HJ_FIELD_ALL | HJ_FIELD_TIME);
+#else
+		/* no clock to give the time by */
+		uint8_t fields = req->fields & HJ_FIELD_ALL;
+#endif
+		uint8_t motors = req->motors & HJ_MOTOR_ALL;
+		uint16_t vals[ADC_CHANNEL_CT];
+		adc_val_cpy(vals);
 
-		motor_info_get(&info.m[0], vals[0], 0);
-		motor_info_get(&info.m[1], vals[1], 1);
+		frame_start();
+		if (!frame_reserve(HJA_PL_FIELDS_OF(fields, motors)))
+			break;
 
-		frame_send(&info, HJA_PL_INFO);
+		frame_append_u8(HJA_PT_FIELDS);
+		frame_append_u8(fields);
+		frame_append_u8(motors);
+#ifdef MCTRL_PID
+		if (fields & HJ_FIELD_TIME)
+			frame_append_u32(clock_now());
+#endif
+
+		uint8_t i;
+		for (i = 0; i < 2; i++) {
+			if (!(motors & HJ_MOTOR(i)))
+				continue;
+			struct motor_snap s;
+			motor_snap_get(&s, vals[i], i);
+			motor_fields_append(&s, fields);
+		}
+		frame_done();
 		break;
 	}
+	HJ_CASE(B, REQ_INFO_DELTA) {
+		struct hjb_pkt_req_info_delta *req = (typeof(req)) buf;
+		uint16_t vals[ADC_CHANNEL_CT];
+		adc_val_cpy(vals);
+		info_delta_send(req, vals);
+		break;
+	}
+	HJ_CASE(B, REQ_STATS) {
+		struct hjb_pkt_req_stats *req = (typeof(req)) buf;
+		bool reset = req->flags & HJB_REQ_STATS_RESET;
+		struct frame_stats st;
+		struct frame_hwm h;
+
+		frame_start();
+		if (!frame_reserve(HJA_PL_STATS))
+			break;
+
+		/* only reset what made it into the ring */
+		frame_stats_get(&st, reset);
+		frame_hwm_get(&h, reset);
+
+		frame_append_u8(HJA_PT_STATS);
+		frame_append_u16(st.rx_frame_err);
+		frame_append_u16(st.rx_overrun);
+		frame_append_u16(st.rx_parity);
+		frame_append_u16(st.rx_crc);
+		frame_append_u16(st.rx_pkt_full);
+		frame_append_u16(st.rx_buf_full);
+		frame_append_u16(st.rx_abort);
+		frame_append_u16(st.tx_full);
+		frame_append_u8(h.rx_bytes);
+		frame_append_u8(h.rx_pkts);
+		frame_append_u8(h.tx_bytes);
+		frame_append_u8(h.tx_pkts);
+		frame_append_u8(h.txu_bytes);
+		frame_append_u8(h.txu_pkts);
+		frame_done();
+		break;
+	}
+
+	HJ_CASE(B, SET_LINE) {
+		struct hjb_pkt_set_line *req = (typeof(req)) buf;
+		line_change(req);
+		break;
+	}
+
+#ifdef FRAME_CREDIT
+	HJ_CASE(B, REQ_CREDIT) {
+		struct hjb_pkt_req_credit *req = (typeof(req)) buf;
+		hj_send_credit(req->token);
+		break;
+	}
+#endif
+
 #ifdef MCTRL_PID
 	HJ_CASE( , PID_K) {
 		struct hj_pkt_pid_k *k = (typeof(k)) buf;
@@ -300,6 +744,27 @@ static bool hj_parse(uint8_t *buf, uint8_t len)
 		break;
 	}
 
+	HJ_CASE(B, SUBSCRIBE) {
+		struct hjb_pkt_subscribe *req = (typeof(req)) buf;
+		stream_start(req->period);
+		break;
+	}
+
+	HJ_CASE(B, SYNC) {
+		struct hjb_pkt_sync *req = (typeof(req)) buf;
+		uint32_t now = clock_now();
+
+		frame_start();
+		if (!frame_reserve(HJA_PL_SYNC))
+			break;
+
+		frame_append_u8(HJA_PT_SYNC);
+		frame_append_u32(ntohl(req->host));
+		frame_append_u32(now);
+		frame_done();
+		break;
+	}
+
 	HJ_CASE(B, PID_SAVE) {
 		pid_k_store_all();
 		break;
@@ -321,6 +786,27 @@ static bool hj_parse(uint8_t *buf, uint8_t len)
 	return false;
 }
 
+/*
+ * hj_parse_split - parse a packet which wraps around the end of the receive
+ *                  buffer, by first joining it up on the stack.
+ *
+ * Kept out of line so the copy only costs stack when it is needed.
+ */
+__attribute__((noinline))
+static bool hj_parse_split(struct frame_seg seg[2])
+{
+	uint8_t buf[HJ_PL_MAX];
+	uint8_t len = seg[0].len + seg[1].len;
+
+	if (len > sizeof(buf)) {
+		hj_send_error(1);
+		return true;
+	}
+
+	memcpy(buf, seg[0].p, seg[0].len);
+	memcpy(buf + seg[0].len, seg[1].p, seg[1].len);
+	return hj_parse(buf, len);
+}
 
 /* watchdog uses a independent 128kHz oscillator. */
 
@@ -402,20 +888,45 @@ void main(void)
 	hj_send_error(10);
 
 	for(;;) {
-		uint8_t buf[HJ_PL_MAX];
-		uint8_t len = frame_recv_copy(buf, sizeof(buf));
-		if (len)
+		struct frame_seg seg[2];
+		uint8_t seg_ct = frame_recv_peek(seg);
+		if (seg_ct) {
+			bool fail;
+			if (seg_ct == 1)
+				fail = hj_parse(seg[0].p, seg[0].len);
+			else
+				fail = hj_parse_split(seg);
+
+			/* replies are already queued, nothing refers to the
+			 * packet any longer */
 			frame_recv_next();
 
-		if (len && !hj_parse(buf, len)) {
-			/* we have recived a valid frame, keep ourselves alive */
-			wdt_progress();
+			if (!fail) {
+				/* we have recived a valid frame, keep
+				 * ourselves alive */
+				wdt_progress();
+			}
 		}
 
+#ifdef FRAME_CREDIT
+		if (frame_credit_due())
+			hj_send_credit(0);
+#endif
+
+#ifdef MCTRL_PID
+		if (stream_due)
+			stream_send();
+#endif
+
 		if (wd_timeout) {
 			struct hj_pkt_header tout
 				= HJA_PKT_TIMEOUT_INITIALIZER;
-			frame_send(&tout, HJA_PL_TIMEOUT);
+			frame_send_urgent(&tout, HJA_PL_TIMEOUT);
+#ifdef MCTRL_PID
+			/* the host has gone quiet, it may be gone */
+			stream_start(0);
+#endif
+			line_fallback();
 			wd_timeout = false;
 		}
 	}
@@ -0,0 +1,8 @@
+/* host stand-in for avr-libc, for isr_cost.c */
+#ifndef SIM_AVR_INTERRUPT_H_
+#define SIM_AVR_INTERRUPT_H_
+
+#define cli()
+#define sei()
+
+#endif
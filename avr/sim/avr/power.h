@@ -0,0 +1,4 @@
+/* host stand-in for avr-libc, for isr_cost.c */
+#ifndef SIM_AVR_POWER_H_
+#define SIM_AVR_POWER_H_
+#endif
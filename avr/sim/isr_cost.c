@@ -0,0 +1,437 @@
+/*
+ * isr_cost - estimate the cost of the usart ISRs in frame_async.c, and fail
+ *            when it eats too much of the time available per byte.
+ *
+ * frame_async.c is built for the host (its !AVR mode, where the ISRs become
+ * frame_rx_isr() and frame_tx_isr()) with -fsanitize-coverage=trace-pc, so
+ * every basic block it executes calls __sanitizer_cov_trace_pc(). The ISRs
+ * are then fed byte streams, and each invocation is charged:
+ *
+ *   isr entry/exit overhead + blocks * cycles per block + crcs * cycles per crc
+ *
+ * This is an estimate, not a simulation: it is meant to catch changes which
+ * add work to the ISRs, and to compare paths against each other, not to
+ * predict exact cycle counts. The defaults put the worst rx + tx pair at
+ * about the 326 cycles speed.txt arrives at by hand.
+ *
+ * Each usart byte time may see one rx and one tx interrupt, so the check is
+ *   worst rx + worst tx <= limit * (F_CPU * bits per char / baud)
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <unistd.h>
+
+#include <frame/frame_proto.h>
+#include <util/crc16.h>
+
+#include "../frame_async.h"
+#include "../../hj_proto.h"
+
+unsigned long sim_crc_calls;
+static unsigned long sim_blocks;
+
+void __sanitizer_cov_trace_pc(void)
+{
+	sim_blocks++;
+}
+
+static struct model {
+	unsigned long f_cpu;
+	unsigned long baud;
+	unsigned bits;		/* per char: start + data + parity + stop */
+	unsigned cyc_isr;	/* vector, prologue, epilogue, reti */
+	unsigned cyc_block;
+	unsigned cyc_crc;
+	double limit;		/* fraction of the byte time we may use */
+} m = {
+	.f_cpu = 16000000,
+	.baud = 57600,
+	.bits = 11,
+	.cyc_isr = 60,
+	.cyc_block = 12,
+	.cyc_crc = 16,
+	.limit = 0.20,
+};
+
+enum path {
+	P_FLAG,
+	P_END,
+	P_DROP,
+	P_ESC,
+	P_ESCAPED,
+	P_DATA,
+	P_RESET,
+	P_CODE,
+	P_CT
+};
+
+static const char *path_name[P_CT] = {
+	[P_FLAG]    = "flag",
+	[P_END]     = "end",
+	[P_DROP]    = "drop",
+	[P_ESC]     = "escape",
+	[P_ESCAPED] = "escaped",
+	[P_DATA]    = "data",
+	[P_RESET]   = "reset",
+	[P_CODE]    = "code",
+};
+
+struct isr_stat {
+	unsigned long n;
+	unsigned long sum;
+	unsigned long worst;
+};
+
+static unsigned long worst_rx, worst_tx;
+
+static void stat_add(struct isr_stat *s, unsigned long blocks,
+		unsigned long crcs)
+{
+	unsigned long c = m.cyc_isr + blocks * m.cyc_block + crcs * m.cyc_crc;
+	s->n++;
+	s->sum += c;
+	if (c > s->worst)
+		s->worst = c;
+}
+
+static void stat_print(const char *isr, const char *scenario,
+		struct isr_stat st[P_CT], unsigned long *worst)
+{
+	int i;
+	for (i = 0; i < P_CT; i++) {
+		struct isr_stat *s = &st[i];
+		if (!s->n)
+			continue;
+		printf("%-3s %-14s %-8s %8lu %8.1f %8lu\n", isr, scenario,
+				path_name[i], s->n, (double)s->sum / s->n,
+				s->worst);
+		if (s->worst > *worst)
+			*worst = s->worst;
+	}
+}
+
+#ifdef FRAME_SEQ
+/* N(S) of the next I frame made. Frames the board drops (other boards',
+ * overflows) still take one, so it goes on to REJ the rest, which costs the
+ * isrs nothing. */
+static uint8_t mk_ns;
+#endif
+
+/* encode a frame the way the host does, @addr < 0 for none */
+static size_t frame_mk_to(uint8_t *o, int addr, const void *data, size_t len)
+{
+	uint8_t d[FRAME_ADDR_SZ + FRAME_CTRL_SZ + len];
+	uint16_t crc = FRAME_CRC_INIT;
+	uint8_t c[FRAME_CRC_SZ];
+	size_t i, h = 0, l = 0;
+
+	if (addr >= 0)
+		d[h++] = addr;
+#ifdef FRAME_SEQ
+	d[h++] = FRAME_CTRL_I(mk_ns++, 0);
+#endif
+	memcpy(d + h, data, len);
+	len += h;
+
+	o[l++] = FRAME_DELIM;
+#ifdef FRAME_COBS
+	size_t code = l++;
+#endif
+	for (i = 0; i < len + FRAME_CRC_SZ; i++) {
+		uint8_t b;
+		if (i < len) {
+			b = d[i];
+			crc = _crc_ccitt_update(crc, b);
+			if (i == len - 1) {
+				crc ^= FRAME_CRC_XOR;
+				c[0] = crc & 0xff;
+				c[1] = crc >> 8;
+			}
+		} else {
+			b = c[i - len];
+		}
+
+#ifdef FRAME_COBS
+		if (b != FRAME_COBS_DELIM)
+			o[l++] = b;
+		if (b == FRAME_COBS_DELIM || l - code == FRAME_COBS_MAX) {
+			o[code] = l - code;
+			code = l++;
+		}
+#else
+		if (FRAME_ESC_CHECK(b)) {
+			o[l++] = FRAME_ESC;
+			b ^= FRAME_ESC_MASK;
+		}
+		o[l++] = b;
+#endif
+	}
+#ifdef FRAME_COBS
+	o[code] = l - code;
+#endif
+	o[l++] = FRAME_DELIM;
+	return l;
+}
+
+/*
+ * path_of - which path the isr takes for @c.
+ *
+ * @st: state carried from byte to byte, starts at 0. Without FRAME_COBS,
+ *      whether the last byte was an escape; with it, the bytes left in the
+ *      current run.
+ */
+static enum path path_of(uint8_t c, unsigned *st)
+{
+	enum path p;
+#ifdef FRAME_COBS
+	p = c == FRAME_DELIM ? P_FLAG
+		: *st ? P_DATA : P_CODE;
+	*st = c == FRAME_DELIM ? 0
+		: *st ? *st - 1 : c - 1u;
+#else
+	p = c == FRAME_START ? P_FLAG
+		: c == FRAME_RESET ? P_RESET
+		: c == FRAME_ESC ? P_ESC
+		: *st ? P_ESCAPED : P_DATA;
+	*st = c == FRAME_ESC;
+#endif
+	return p;
+}
+
+#ifdef FRAME_NODE
+# define MK_ADDR FRAME_ADDR(FRAME_NODE)
+#else
+# define MK_ADDR -1
+#endif
+
+#define frame_mk(o, data, len) frame_mk_to(o, MK_ADDR, data, len)
+
+static void rx_drain(void)
+{
+	uint8_t buf[HJ_PL_MAX];
+	while (frame_recv_have_pkt()) {
+		frame_recv_copy(buf, sizeof(buf));
+		frame_recv_next();
+	}
+}
+
+/*
+ * rx_run - feed @s to the rx isr, a byte per invocation.
+ *
+ * @consume: empty the receive queue after every flag, as a main loop which
+ *           keeps up would. Otherwise the queue fills and frames are dropped.
+ */
+static void rx_run(const char *scenario, const uint8_t *s, size_t len,
+		bool consume)
+{
+	struct isr_stat st[P_CT] = {};
+	FILE *in = fmemopen((void *)s, len, "r");
+	FILE *old = stdin;
+	unsigned st_path = 0;
+	size_t i;
+
+	rx_drain();
+	stdin = in;
+	for (i = 0; i < len; i++) {
+		uint8_t c = s[i];
+		enum path p = path_of(c, &st_path);
+
+		uint8_t ct = frame_recv_ct();
+		unsigned long b = sim_blocks, crc = sim_crc_calls;
+		frame_rx_isr();
+		unsigned long db = sim_blocks - b;
+		unsigned long dcrc = sim_crc_calls - crc;
+
+		/* a flag following data closes a frame, which is either
+		 * queued or dropped (bad crc, no room) */
+		if (p == P_FLAG && i && s[i - 1] != FRAME_DELIM)
+			p = frame_recv_ct() != ct ? P_END : P_DROP;
+		stat_add(&st[p], db, dcrc);
+
+		if (consume && c == FRAME_DELIM)
+			rx_drain();
+	}
+	stdin = old;
+	fclose(in);
+
+	stat_print("rx", scenario, st, &worst_rx);
+}
+
+/*
+ * tx_run - queue @ct copies of @data with frame_send, @burst at a time, and
+ *          run the tx isr for as long as it leaves itself enabled.
+ */
+static void tx_run(const char *scenario, const void *data, uint8_t len,
+		unsigned ct, unsigned burst)
+{
+	struct isr_stat st[P_CT] = {};
+	char *out;
+	size_t out_len;
+	FILE *o = open_memstream(&out, &out_len);
+	FILE *old = stdout;
+	unsigned st_path = 0;
+	unsigned i, j;
+
+	stdout = o;
+	for (i = 0; i < ct; i += burst) {
+		for (j = 0; j < burst; j++)
+			frame_send(data, len);
+
+		while (frame_udre_ie) {
+			unsigned long b = sim_blocks, crc = sim_crc_calls;
+			long pos = ftell(o);
+			frame_tx_isr();
+			unsigned long db = sim_blocks - b;
+			unsigned long dcrc = sim_crc_calls - crc;
+
+			fflush(o);
+			if (ftell(o) == pos) {
+				/* spurious, the ring was empty */
+				continue;
+			}
+
+			enum path p = path_of(out[pos], &st_path);
+			stat_add(&st[p], db, dcrc);
+		}
+	}
+	stdout = old;
+	fclose(o);
+	free(out);
+
+	stat_print("tx", scenario, st, &worst_tx);
+}
+
+static void usage(const char *prgm)
+{
+	fprintf(stderr,
+"usage: %s [options]\n"
+"  -b <baud>      line rate                    (%lu)\n"
+"  -n <bits>      bits per char on the wire    (%u)\n"
+"  -F <hz>        cpu clock                    (%lu)\n"
+"  -l <fraction>  share of a byte time the isrs may use (%.2f)\n"
+"  -I <cycles>    isr entry + exit overhead    (%u)\n"
+"  -B <cycles>    per basic block              (%u)\n"
+"  -C <cycles>    per _crc_ccitt_update        (%u)\n",
+		prgm, m.baud, m.bits, m.f_cpu, m.limit, m.cyc_isr,
+		m.cyc_block, m.cyc_crc);
+	exit(2);
+}
+
+int main(int argc, char **argv)
+{
+	int c;
+	while ((c = getopt(argc, argv, "b:n:F:l:I:B:C:h")) != -1) {
+		switch (c) {
+		case 'b': m.baud = strtoul(optarg, NULL, 0); break;
+		case 'n': m.bits = strtoul(optarg, NULL, 0); break;
+		case 'F': m.f_cpu = strtoul(optarg, NULL, 0); break;
+		case 'l': m.limit = strtod(optarg, NULL); break;
+		case 'I': m.cyc_isr = strtoul(optarg, NULL, 0); break;
+		case 'B': m.cyc_block = strtoul(optarg, NULL, 0); break;
+		case 'C': m.cyc_crc = strtoul(optarg, NULL, 0); break;
+		default:
+			usage(argv[0]);
+		}
+	}
+
+	if (!m.baud)
+		usage(argv[0]);
+
+	static uint8_t s[8192];
+	size_t l, i;
+
+	/* typical traffic */
+	struct hjb_pkt_set_speed ss = {
+		.head = { .type = HJB_PT_SET_SPEED },
+		.vel = { 0x7e01, 0x7d7f }
+	};
+	struct hj_pkt_header ri = HJB_PKT_REQ_INFO_INITIALIZER;
+	struct hja_pkt_info info = HJA_PKT_INFO_INITIALIZER;
+	memset(&info.m, 0x5a, sizeof(info.m));
+	info.m[0].e.p = 0x7e7d7f00;
+
+	/* worst case for escaping: with FRAME_COBS, a zero ends a run, so each
+	 * byte sent is a code byte */
+#ifdef FRAME_COBS
+# define ALL_ESC "all_zero"
+	uint8_t all_esc[HJ_PL_MAX] = {};
+#else
+# define ALL_ESC "all_escape"
+	uint8_t all_esc[HJ_PL_MAX];
+	memset(all_esc, FRAME_ESC, sizeof(all_esc));
+#endif
+
+	printf("%-3s %-14s %-8s %8s %8s %8s\n", "isr", "scenario", "path",
+			"n", "avg", "worst");
+
+	for (l = 0, i = 0; i < 32; i++) {
+		l += frame_mk(s + l, &ss, sizeof(ss));
+		l += frame_mk(s + l, &ri, sizeof(ri));
+	}
+	rx_run("commands", s, l, true);
+
+	for (l = 0, i = 0; i < 32; i++)
+		l += frame_mk(s + l, all_esc, sizeof(all_esc));
+	rx_run(ALL_ESC, s, l, true);
+
+#ifdef FRAME_NODE
+	/* a shared line, most frames are for the other boards */
+	for (l = 0, i = 0; i < 32; i++) {
+		l += frame_mk_to(s + l, FRAME_ADDR(FRAME_NODE + 1), &ss,
+				sizeof(ss));
+		l += frame_mk_to(s + l, FRAME_ADDR_BCAST, &ss, sizeof(ss));
+		l += frame_mk(s + l, &ri, sizeof(ri));
+	}
+	rx_run("multi_drop", s, l, true);
+#endif
+
+	/* nobody reading: the packet index fills, then a frame too long for
+	 * the byte ring, then one cut short by a reset (which FRAME_COBS does
+	 * not have) */
+	for (l = 0, i = 0; i < 32; i++)
+		l += frame_mk(s + l, &ss, sizeof(ss));
+	rx_run("overflow", s, l, false);
+	uint8_t held_ss = frame_recv_ct();
+	rx_drain();
+	for (l = 0, i = 0; i < 32; i++)
+		l += frame_mk(s + l, &ri, sizeof(ri));
+	rx_run("overflow_short", s, l, false);
+	uint8_t held_ri = frame_recv_ct();
+	rx_drain();
+	uint8_t big[128];
+	memset(big, 0x55, sizeof(big));
+	l = frame_mk(s, big, sizeof(big));
+	rx_run("overflow_big", s, l, false);
+#ifndef FRAME_COBS
+	l = frame_mk(s, &info, sizeof(info));
+	s[l / 2] = FRAME_RESET;
+	rx_run("reset", s, l, true);
+#endif
+
+	tx_run("info", &info, sizeof(info), 32, 1);
+	tx_run("set_speed_x4", &ss, sizeof(ss), 32, 4);
+	tx_run(ALL_ESC, all_esc, 24, 32, 1);
+
+	double byte_cyc = (double)m.f_cpu * m.bits / m.baud;
+	unsigned long worst = worst_rx + worst_tx;
+	double used = worst / byte_cyc;
+
+	printf("\nrx queue: %u bytes of ram, holds %u set_speed or %u req_info"
+			" frames\n", frame_rx_ram, held_ss, held_ri);
+	printf("byte time: %lu Hz * %u bits / %lu baud = %.0f cycles\n",
+			m.f_cpu, m.bits, m.baud, byte_cyc);
+	printf("worst rx %lu + worst tx %lu = %lu cycles, %.1f%% of a byte"
+			" time (limit %.1f%%)\n",
+			worst_rx, worst_tx, worst, used * 100, m.limit * 100);
+
+	if (used > m.limit) {
+		printf("FAIL: isr cost over budget\n");
+		return 1;
+	}
+
+	printf("ok\n");
+	return 0;
+}
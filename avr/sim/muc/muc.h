@@ -0,0 +1,12 @@
+/* host stand-in for the parts of libmuc frame_async.c uses, for isr_cost.c */
+#ifndef SIM_MUC_H_
+#define SIM_MUC_H_
+
+#include <stdio.h>
+#include <arpa/inet.h>
+
+#define MIN(a, b) ((a) < (b) ? (a) : (b))
+#define barrier() asm("":::"memory")
+#define unused __attribute__((unused))
+
+#endif
@@ -0,0 +1,20 @@
+/* host stand-in for libpenny's circ_buf.h, for isr_cost.c */
+#ifndef SIM_CIRC_BUF_H_
+#define SIM_CIRC_BUF_H_
+
+#define CIRC_NEXT(val, size) (((val) + 1) & ((size) - 1))
+
+#define CIRC_CNT(head, tail, size) (((head) - (tail)) & ((size) - 1))
+#define CIRC_SPACE(head, tail, size) CIRC_CNT((tail), ((head) + 1), (size))
+
+#define CIRC_CNT_TO_END(head, tail, size) ({			\
+	int end_ = (size) - (tail);				\
+	int n_ = ((head) + end_) & ((size) - 1);		\
+	n_ < end_ ? n_ : end_; })
+
+#define CIRC_SPACE_TO_END(head, tail, size) ({			\
+	int end_ = (size) - 1 - (head);				\
+	int n_ = (end_ + (tail)) & ((size) - 1);		\
+	n_ <= end_ ? n_ : end_ + 1; })
+
+#endif
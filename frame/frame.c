@@ -1,9 +1,10 @@
 #include <stdbool.h>
 #include <stdint.h>
 
-#include <util/crc.h>
+#include <util/crc16.h>
 
-#include <frame/hw_proto.h>
+#include <frame/frame_proto.h>
+#include <frame/frame.h>
 
 #if 0
 typedef struct frame_send_ctx {
@@ -56,139 +57,119 @@ void frame_send_done(frame_send_ctx *fc)
 	fc->putchar(FRAME_START);
 }
 
-typedef struct frame_recv_ctx {
-	uint8_t head;
-	uint8_t tail;
-	uint8_t data[64];
+#endif
 
-	uint16_t crc;
+/*** frame_recv_ctx, see frame.h ***/
+
+#define POS(x) ((x) & FRAME_RECV_CTX_MASK)
 
-	bool started;
-	bool esc;
-	bool x;
-} frame_recv_ctx;
+static void frame_recv_drop(frame_recv_ctx *fc)
+{
+	fc->started = false;
+	fc->esc = false;
+	fc->data[fc->head] = 0;
+}
 
-void frame_recv_feed(frame_recv_ctx *fc, uint8_t c)
+enum frame_recv_res frame_recv_ctx_feed(frame_recv_ctx *fc, uint8_t c)
 {
 	uint8_t head = fc->head;
 	uint8_t phead = fc->data[head];
 
-	/* FIXME: is this +1 needed? */
-	uint8_t next_pos = (head + phead + 1) & (sizeof(fc->data) - 1);
+	/* the position after the end of the packet being received, the next
+	 * byte (or the next packet's length) goes here. */
+	uint8_t next_pos = POS(head + phead + 1);
 
-	if (c == FRAME_START) {
+	if (c == FRAME_DELIM) {
 		fc->started = true;
 		fc->esc = false;
+#ifdef FRAME_COBS
+		fc->cobs_left = 0;
+#endif
 
-		if (phead != 0) {
-			/* current packet has data */
-
-			if (fc->crc != 0 || next_pos == fc->tail) {
-				/* Invalid CRC or no space. Avoid packet
-				 * advance */
-				phead = 0;
-				fc->data[head] = phead;
-			} else {
-				/* trim crc */
-				phead -= FRAME_CRC_SZ;
-				fc->data[head] = phead;
-
-				/* FIXME: should this be next_pos - 1? */
-				fc->head = next_pos;
-
-				/* packet has 0 len initially */
-				fc->data[fc->head] = 0;
-			}
-
+		if (phead == 0) {
+			/* nothing received, no need to advance */
+			return FRAME_RECV_NONE;
 		}
 
-		fc->crc = FRAME_CRC_INIT;
-		return;
+		/* storing bytes always leaves room for this. */
+		/* packet has 0 len initially */
+		fc->data[next_pos] = 0;
+		fc->head = next_pos;
+		fc->in++;
+		return FRAME_RECV_PKT;
 	}
 
-
 	if (!fc->started) {
-		return;
+		/* ignore stuff until we get a start byte */
+		return FRAME_RECV_NONE;
 	}
 
+#ifdef FRAME_COBS
+	if (!fc->cobs_left) {
+		/* a code byte, the zero after the last run (esc) is due */
+		bool zero = fc->esc;
+		fc->cobs_left = c - 1;
+		fc->esc = c != FRAME_COBS_MAX;
+		if (!zero)
+			return FRAME_RECV_NONE;
+		c = 0;
+	} else {
+		fc->cobs_left--;
+	}
+#else
 	if (c == FRAME_RESET) {
-		goto drop_packet;
+		frame_recv_drop(fc);
+		return FRAME_RECV_ABORT;
 	}
 
 	if (c == FRAME_ESC) {
 		fc->esc = true;
-		return;
+		return FRAME_RECV_NONE;
 	}
 
 	if (fc->esc) {
 		fc->esc = false;
 		c ^= FRAME_ESC_MASK;
 	}
+#endif
 
-	fc->crc = _crc_ccitt_update(fc->crc, c);
-
-	if (next_pos != fc->tail) {
-		/* there is more space */
-		uint8_t pos = (head + phead) & (sizeof(fc->data) - 1);
-		fc->data[pos] = c;
-		phead += 1;
-		fc->data[head] = phead;
+	if (!phead && fc->addr && c != fc->addr && c != FRAME_ADDR_BCAST) {
+		/* for another node, ignore it until the next flag */
+		fc->started = false;
+		return FRAME_RECV_NONE;
 	}
 
-	/* no more space */
-
-drop_packet:
-	fc->started = false;
-	fc->esc = false;
-	fc->crc = FRAME_CRC_INIT;
+	if (next_pos == fc->tail || POS(next_pos + 1) == fc->tail) {
+		/* no more space, with room kept for the next packet's
+		 * length (head == tail would be an empty queue). next_pos
+		 * reaches tail when a packet ends just before it. */
+		frame_recv_drop(fc);
+		return FRAME_RECV_FULL;
+	}
 
-	fc->data[head] = 0;
+	fc->data[next_pos] = c;
+	fc->data[head] = phead + 1;
+	return FRAME_RECV_NONE;
 }
 
-void frame_recv_error(frame_recv_ctx *fc)
+void frame_recv_ctx_error(frame_recv_ctx *fc)
 {
 	/* drop current packet. */
-	fc->started = false;
-	fc->esc = false;
-	fc->crc = FRAME_CRC_INIT;
-	fc->data[fc->head] = 0;
+	frame_recv_drop(fc);
 }
 
-/* returns len */
-uint8_t frame_recv_start(frame_recv_ctx *fc)
+void frame_recv_ctx_advance(frame_recv_ctx *fc, uint8_t n)
 {
-	/* no packet */
-	if (fc->tail == fc->head)
-		return 0;
-
-	return fc->data[fc->tail];
-}
-
-uint8_t frame_recv_u8(frame_recv_ctx *fc)
-{
-	/* return the next byte from the current packet and advance the tail */
-	/* ASSUMED: there exsists data in the current packet */
-
-	/* fc->tail always points to the packet len */
-	uint8_t nlen = fc->data[fc->tail] - 1;
-	uint8_t ntail = (fc->tail + 1) & (sizeof(fc->data) - 1);
-	uint8_t d = fc->data[ntail];
-
-	/* XXX: ordering appears unimportant, check? */
+	/* the byte before the next unread one becomes the length, the new
+	 * length is stored before tail is moved so the producer never sees
+	 * a stale one. */
+	uint8_t ntail = POS(fc->tail + n);
+	fc->data[ntail] = fc->data[fc->tail] - n;
 	fc->tail = ntail;
-	fc->data[ntail] = nlen;
-
-	return d;
 }
 
-void frame_recv_done(frame_recv_ctx *fc)
+void frame_recv_ctx_next(frame_recv_ctx *fc)
 {
-	/* TODO: update tail to the start of the next packet */
-	fc->tail = (fc->tail + fc->data[fc->tail]) & (sizeof(fc->data) - 1);
+	fc->tail = POS(fc->tail + fc->data[fc->tail] + 1);
+	fc->out++;
 }
-
-void frame_recv_copy(frame_recv_ctx *fc, uint8_t *dst, uint8_t len)
-{
-	
-}
-#endif
@@ -0,0 +1,106 @@
+#ifndef FRAME_FRAME_H_
+#define FRAME_FRAME_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/*
+ * frame_recv_ctx - a receive queue which keeps packets length-prefixed in a
+ *                  single array:
+ *
+ *     [len] [data * len] [len] [data * len] ... [len = 0]
+ *      ^ tail                                    ^ head
+ *
+ * head is the length byte of the packet being received, tail that of the
+ * packet being consumed. As the consumer reads bytes its length byte moves
+ * forward with it, so space is returned as it is read.
+ *
+ * The number of packets held is limited only by the bytes they need (one
+ * more than their length), rather than by a separate index ring.
+ *
+ * Crcs are not checked, the consumer does so.
+ *
+ * One producer (frame_recv_ctx_feed, frame_recv_ctx_error) and one consumer
+ * may use it concurrently. A zeroed frame_recv_ctx is empty.
+ *
+ * When addr is set (FRAME_ADDR(node)), packets whose first byte is neither
+ * it nor FRAME_ADDR_BCAST are skipped without being stored. The address
+ * byte of those kept is left in the packet.
+ */
+#ifndef FRAME_RECV_CTX_SZ
+# define FRAME_RECV_CTX_SZ 64
+#endif
+
+#if !FRAME_RECV_CTX_SZ || (FRAME_RECV_CTX_SZ & (FRAME_RECV_CTX_SZ - 1)) \
+		|| FRAME_RECV_CTX_SZ > 256
+# error "FRAME_RECV_CTX_SZ must be a power of 2, no larger than 256"
+#endif
+
+#define FRAME_RECV_CTX_MASK (FRAME_RECV_CTX_SZ - 1)
+
+typedef struct frame_recv_ctx {
+	uint8_t head;
+	uint8_t tail;
+	uint8_t data[FRAME_RECV_CTX_SZ];
+
+	/* packets queued, and consumed. free running, each written only by
+	 * one side */
+	uint8_t in;
+	uint8_t out;
+
+	bool started;
+	bool esc;	/* FRAME_COBS: a zero ends the current run */
+#ifdef FRAME_COBS
+	uint8_t cobs_left;	/* bytes of the run still to come */
+#endif
+
+	/* 0: keep every packet */
+	uint8_t addr;
+} frame_recv_ctx;
+
+/* what frame_recv_ctx_feed did with a byte */
+enum frame_recv_res {
+	FRAME_RECV_NONE,	/* stored, or nothing to do */
+	FRAME_RECV_PKT,		/* a packet was queued */
+	FRAME_RECV_FULL,	/* no room, the packet was dropped */
+	FRAME_RECV_ABORT,	/* FRAME_RESET, the packet was dropped (not
+				 * with FRAME_COBS) */
+};
+
+/** producer **/
+enum frame_recv_res frame_recv_ctx_feed(frame_recv_ctx *fc, uint8_t c);
+
+/* drop the packet being received, ie: on a usart error. */
+void frame_recv_ctx_error(frame_recv_ctx *fc);
+
+/** consumer **/
+static inline bool frame_recv_ctx_empty(frame_recv_ctx *fc)
+{
+	return fc->tail == fc->head;
+}
+
+/* return: the number of packets queued, including the current one */
+static inline uint8_t frame_recv_ctx_ct(frame_recv_ctx *fc)
+{
+	return fc->in - fc->out;
+}
+
+/* return: unread bytes in the current packet */
+static inline uint8_t frame_recv_ctx_len(frame_recv_ctx *fc)
+{
+	return fc->data[fc->tail];
+}
+
+/* return: the position in fc->data of the next unread byte */
+static inline uint8_t frame_recv_ctx_pos(frame_recv_ctx *fc)
+{
+	return (fc->tail + 1) & FRAME_RECV_CTX_MASK;
+}
+
+/* mark n bytes of the current packet as read, freeing them */
+void frame_recv_ctx_advance(frame_recv_ctx *fc, uint8_t n);
+
+/* move on to the next packet, dropping the rest of the current one */
+void frame_recv_ctx_next(frame_recv_ctx *fc);
+
+#endif
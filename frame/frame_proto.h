@@ -14,6 +14,11 @@
 #define FRAME_CRC_INIT 0xffff
 #define FRAME_CRC_SZ sizeof(uint16_t)
 
+/* line settings at reset (8 data bits, odd parity, 1 stop bit), and those
+ * both ends drop back to when the link goes quiet after a change */
+#define FRAME_LINE_BAUD 57600
+#define FRAME_LINE_PARITY 1
+
 #define FRAME_START ((uint8_t)0x7e)
 #define FRAME_RESET ((uint8_t)0x7f)
 #define FRAME_ESC   ((uint8_t)0x7d)
@@ -22,4 +27,77 @@
 #define FRAME_ESC_CHECK(c) \
 	((c) == FRAME_START || (c) == FRAME_RESET || (c) == FRAME_ESC)
 
+/* COBS framing (FRAME_COBS, both ends must agree), in place of the escapes
+ * above. Frames are delimited by FRAME_COBS_DELIM, and the payload and crc
+ * between are sent as runs of non-zero bytes, each led by a code byte:
+ *   [code = run length + 1] [run]
+ * Every run but the last is followed by an (implied, unsent) zero, unless
+ * its code is FRAME_COBS_MAX, which is a run of 254 with no zero after it.
+ * The overhead is 1 byte in 254 (plus 1), whatever the data. There is no
+ * equivalent of FRAME_RESET.
+ */
+#define FRAME_COBS_DELIM ((uint8_t)0x00)
+#define FRAME_COBS_MAX   ((uint8_t)0xff)
+
+#ifdef FRAME_COBS
+# define FRAME_DELIM FRAME_COBS_DELIM
+#else
+# define FRAME_DELIM FRAME_START
+#endif
+
+/* With FRAME_COBS the crc is sent complemented (as HDLC sends its FCS):
+ * a zero at the end of a frame is implied by its last code byte, and a
+ * message with a zero crc residue still has one with trailing zeros
+ * removed, so a corrupt code byte could otherwise cut a frame short
+ * unnoticed. A good frame then leaves a residue of FRAME_CRC_GOOD. */
+#ifdef FRAME_COBS
+# define FRAME_CRC_XOR  0xffff
+# define FRAME_CRC_GOOD 0xf0b8
+#else
+# define FRAME_CRC_XOR  0
+# define FRAME_CRC_GOOD 0
+#endif
+
+/* Optional address byte (multi-drop lines), first in the frame and covered
+ * by the crc:
+ *   [multicast:1] [node addr:6] ['1':1]
+ * Frames to a board carry its address (or the broadcast one), frames from
+ * a board carry its own.
+ */
+#define FRAME_ADDR_SZ 1
+#define FRAME_ADDR(node)      ((uint8_t)(((node) << 1) | 1))
+#define FRAME_ADDR_NODE(addr) (((addr) >> 1) & 0x3f)
+#define FRAME_ADDR_BCAST      ((uint8_t)0xff)
+
+/* Optional control byte (sequenced links), after the address:
+ *   I  [N(R):3] [P:1]   [N(S):3]   ['0':1]  numbered data
+ *   S  [N(R):3] [P/F:1] [S:2] ['01':2]      RR: ack, REJ: resend from N(R)
+ *   U  [M:3]    [P/F:1] [M:2] ['11':2]      SABM: reset, UA: reset done,
+ *                                           UI: unnumbered data
+ * N(S) numbers I frames, N(R) acknowledges every frame before it. Both are
+ * modulo FRAME_SEQ_MOD.
+ */
+#define FRAME_CTRL_SZ 1
+#define FRAME_SEQ_MOD 8
+#define FRAME_SEQ_MASK (FRAME_SEQ_MOD - 1)
+
+#define FRAME_CTRL_PF ((uint8_t)0x10)
+
+#define FRAME_CTRL_I(ns, nr) \
+	((uint8_t)(((nr) & FRAME_SEQ_MASK) << 5 | ((ns) & FRAME_SEQ_MASK) << 1))
+#define FRAME_CTRL_RR(nr)  ((uint8_t)(((nr) & FRAME_SEQ_MASK) << 5 | 0x01))
+#define FRAME_CTRL_REJ(nr) ((uint8_t)(((nr) & FRAME_SEQ_MASK) << 5 | 0x09))
+#define FRAME_CTRL_SABM ((uint8_t)0x2f)
+#define FRAME_CTRL_UA   ((uint8_t)0x63)
+#define FRAME_CTRL_UI   ((uint8_t)0x03)
+
+#define FRAME_CTRL_IS_I(c)   (!((c) & 0x01))
+#define FRAME_CTRL_IS_S(c)   (((c) & 0x03) == 0x01)
+#define FRAME_CTRL_NS(c)     (((c) >> 1) & FRAME_SEQ_MASK)
+#define FRAME_CTRL_NR(c)     ((c) >> 5)
+/* S and U frames, without N(R) or P/F */
+#define FRAME_CTRL_S(c)      ((c) & 0x0f)
+#define FRAME_CTRL_U(c)      ((c) & ~FRAME_CTRL_PF)
+#define FRAME_CTRL_IS_REJ(c) (FRAME_CTRL_S(c) == FRAME_CTRL_REJ(0))
+
 #endif
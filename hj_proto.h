@@ -2,6 +2,7 @@
 #define HJ_PROTO_H_
 
 #include <stdint.h>
+#include <stddef.h>
 #ifndef __packed
 # define __packed __attribute__((packed))
 #endif
@@ -39,6 +40,15 @@ struct hj_pktc_motor_info {
 	int16_t vel;
 } __packed;
 
+/* zigzag: small signed deltas to small unsigned ones, for varints */
+#define HJ_ZIGZAG(d)   (((uint32_t)(d) << 1) ^ (uint32_t)((int32_t)(d) >> 31))
+#define HJ_UNZIGZAG(u) ((int32_t)((u) >> 1) ^ -(int32_t)((u) & 1))
+
+/* varints: 7 bits a byte, least significant first, the top bit set on all
+ * but the last */
+#define HJ_VARINT_MORE 0x80
+#define HJ_VARINT_MAX(bits) (((bits) + 6) / 7)
+
 /** packets dispatched both ways **/
 struct hj_pkt_pid_k {
 	struct hj_pkt_header head;
@@ -54,6 +64,103 @@ struct hjb_pkt_set_speed {
 	int16_t vel[2];
 } __packed;
 
+/* as HJB_PT_SET_SPEED, and answered with the HJA_PT_INFO of the moment the
+ * new speeds were set */
+struct hjb_pkt_set_speed_info {
+	struct hj_pkt_header head;
+	int16_t vel[2];
+} __packed;
+
+/* the fields of a hj_pktc_motor_info, and the motors, a HJB_PT_REQ_FIELDS
+ * asks for */
+#define HJ_FIELD_CURRENT (1 << 0)
+#define HJ_FIELD_P       (1 << 1)
+#define HJ_FIELD_N       (1 << 2)
+#define HJ_FIELD_L       (1 << 3)
+#define HJ_FIELD_PWR     (1 << 4)
+#define HJ_FIELD_VEL     (1 << 5)
+#define HJ_FIELD_ALL     0x3f
+/* not a motor's: the board's clock as it took them, ahead of the motors */
+#define HJ_FIELD_TIME    (1 << 6)
+#define HJ_MOTOR(i)      (1 << (i))
+#define HJ_MOTOR_ALL     0x03
+
+/* bytes the fields @f take for each motor, and a HJA_PT_FIELDS with them
+ * for the motors @m. Evaluate their arguments more than once. */
+#define HJ_FIELDS_SZ(f)					\
+	((((f) & HJ_FIELD_CURRENT) ? 2 : 0)		\
+	 + (((f) & HJ_FIELD_P) ? 4 : 0)			\
+	 + (((f) & HJ_FIELD_N) ? 4 : 0)			\
+	 + (((f) & HJ_FIELD_L) ? 2 : 0)			\
+	 + (((f) & HJ_FIELD_PWR) ? 2 : 0)		\
+	 + (((f) & HJ_FIELD_VEL) ? 2 : 0))
+#define HJA_PL_FIELDS_OF(f, m)				\
+	(HJA_PL_FIELDS_MIN + ((f) & HJ_FIELD_TIME ? 4 : 0)	\
+	 + HJ_FIELDS_SZ(f)				\
+	 * (((m) & HJ_MOTOR(0) ? 1 : 0) + ((m) & HJ_MOTOR(1) ? 1 : 0)))
+
+/* answered with a HJA_PT_FIELDS holding only these, unknown bits ignored */
+struct hjb_pkt_req_fields {
+	struct hj_pkt_header head;
+	uint8_t fields;		/* HJ_FIELD_* */
+	uint8_t motors;		/* HJ_MOTOR() */
+} __packed;
+
+struct hjb_pkt_req_stats {
+	struct hj_pkt_header head;
+#define HJB_REQ_STATS_RESET (1 << 0) /* zero the counts once sent */
+	uint8_t flags;
+} __packed;
+
+/* ask for a HJA_PT_CREDIT now, see pc/credit.h */
+struct hjb_pkt_req_credit {
+	struct hj_pkt_header head;
+	uint8_t token;	/* returned in the reply, non-zero */
+} __packed;
+
+/* ask for a HJA_PT_INFO_DELTA */
+struct hjb_pkt_req_info_delta {
+	struct hj_pkt_header head;
+#define HJB_INFO_DELTA_KEY (1 << 0) /* have no snapshot, send them all */
+	uint8_t flags;
+	uint8_t ack;	/* seq of the newest snapshot taken */
+} __packed;
+
+/* change the line settings. The board answers with a HJA_PT_LINE at the old
+ * ones, then switches. It goes back to FRAME_LINE_BAUD with parity when no
+ * frame arrives for a watchdog period (0.5s), see pc/line.h. It cannot tell
+ * settings which do not work from a host with nothing to say, so a host
+ * which has moved the line must keep frames coming more often than that
+ * (a bare HJ_PT_ECHO will do), and move it again when answers stop. */
+struct hjb_pkt_set_line {
+	struct hj_pkt_header head;
+	uint32_t baud;
+#define HJ_LINE_NO_PARITY (1 << 0)
+	uint8_t flags;
+} __packed;
+
+/* the PID timer's tick: 1024 * 256 cycles of a 16MHz clock */
+#define HJ_TICK_US 16384
+
+/* the board's clock counts the PID timer's count, extended with the ticks:
+ * a uint32_t of HJ_CLOCK_US each, free running (wrapping after 76 hours)
+ * from boot */
+#define HJ_CLOCK_US 64
+
+/* answered with a HJA_PT_SYNC, see pc/hj_sync.h */
+struct hjb_pkt_sync {
+	struct hj_pkt_header head;
+	uint32_t host;		/* the host's time, sent back as is */
+} __packed;
+
+/* send a HJA_PT_STREAM every @period ticks, without being asked. 0 stops.
+ * So does a watchdog period (0.5s) with no frame from the host, which
+ * should repeat this to keep it going. */
+struct hjb_pkt_subscribe {
+	struct hj_pkt_header head;
+	uint8_t period;
+} __packed;
+
 /** packets returned FROM the hj. **/
 struct hja_pkt_info {
 	struct hj_pkt_header head;
@@ -68,6 +175,104 @@ struct hja_pkt_error {
 	char ver[8];
 } __packed;
 
+/* counts of dropped frames by cause, and ring high water marks, since the
+ * last reset. Each count sticks at 0xffff. */
+struct hja_pkt_stats {
+	struct hj_pkt_header head;
+	uint16_t rx_frame_err;
+	uint16_t rx_overrun;
+	uint16_t rx_parity;
+	uint16_t rx_crc;
+	uint16_t rx_pkt_full;
+	uint16_t rx_buf_full;
+	uint16_t rx_abort;
+	uint16_t tx_full;
+	uint8_t rx_hwm_bytes;
+	uint8_t rx_hwm_pkts;
+	uint8_t tx_hwm_bytes;
+	uint8_t tx_hwm_pkts;
+	uint8_t txu_hwm_bytes;
+	uint8_t txu_hwm_pkts;
+} __packed;
+
+/* room in the receive queue (FRAME_CREDIT). Sent unasked when frames are
+ * freed, and in reply to HJB_PT_REQ_CREDIT. */
+struct hja_pkt_credit {
+	struct hj_pkt_header head;
+	uint8_t token;		/* of the request, 0 when unasked */
+	uint8_t seen;		/* frames received (queued or dropped), wraps */
+	uint8_t free_pkts;	/* 0xff: limited by bytes alone */
+	uint8_t free_bytes;	/* a frame takes its length, crc included, +1 */
+} __packed;
+
+/* the fields of a hja_pkt_info as deltas against an earlier snapshot
+ * (the last the host acknowledged, which it must still have, see
+ * pc/hj_delta.h), or against zero for a keyframe. The board keeps the
+ * last HJ_DELTA_HIST snapshots, and sends a keyframe at least every
+ * HJ_DELTA_KEY_EVERY.
+ *
+ * v[] holds, for each motor in turn: current, e.p, e.n, e.l, pwr and vel,
+ * each as the zigzag varint of its difference in its own width. Sent only
+ * as long as it needs to be. */
+#define HJ_DELTA_HIST 4
+#define HJ_DELTA_KEY_EVERY 16
+#define HJ_DELTA_FIELDS 12
+#define HJ_DELTA_V_MAX (2 * (4 * HJ_VARINT_MAX(16) + 2 * HJ_VARINT_MAX(32)))
+struct hja_pkt_info_delta {
+	struct hj_pkt_header head;
+	uint8_t seq;	/* of this snapshot, wraps */
+	uint8_t base;	/* seq it is against, or seq for a keyframe */
+	uint8_t v[HJ_DELTA_V_MAX];
+} __packed;
+
+/* the line settings the board is switching to: those asked for, or the
+ * present ones when it cannot make them */
+struct hja_pkt_line {
+	struct hj_pkt_header head;
+	uint32_t baud;
+	uint8_t flags;
+} __packed;
+
+/* a sample taken on a tick of the PID timer. e.l is the count over that
+ * tick. The board slows down (doubling the period it samples at, up to
+ * 255) rather than queue samples behind a busy tx ring, and speeds back up
+ * once it empties. */
+struct hja_pkt_stream {
+	struct hj_pkt_header head;
+	uint8_t period;		/* ticks since the last sample taken */
+	uint8_t skipped;	/* samples taken but not sent since the last
+				 * one sent, sticks at 0xff */
+	uint32_t time;		/* of the tick, by the board's clock */
+	struct hj_pktc_motor_info m[2];
+} __packed;
+
+/* a hja_pkt_info cut down to the fields and motors asked for (as taken,
+ * without the unknown bits). v[] holds the time, if asked for, then for
+ * each motor asked for in turn the fields asked for, in the order and
+ * width of a hj_pktc_motor_info. Sent only as long as that,
+ * HJA_PL_FIELDS_OF(fields, motors). */
+struct hja_pkt_fields {
+	struct hj_pkt_header head;
+	uint8_t fields;
+	uint8_t motors;
+	uint8_t v[sizeof(uint32_t) + 2 * sizeof(struct hj_pktc_motor_info)];
+} __packed;
+
+/* the board's clock as it took the HJB_PT_SYNC from its queue */
+struct hja_pkt_sync {
+	struct hj_pkt_header head;
+	uint32_t host;
+	uint32_t board;
+} __packed;
+
+/* sent back by the board as it is, up to HJ_PL_ECHO long, to time the
+ * link */
+#define HJ_ECHO_MAX 32
+struct hj_pkt_echo {
+	struct hj_pkt_header head;
+	uint8_t data[HJ_ECHO_MAX];
+} __packed;
+
 /** **/
 union hj_pkt_union {
 	struct hj_pkt_header a;
@@ -75,6 +280,22 @@ union hj_pkt_union {
 	struct hja_pkt_error c;
 	struct hjb_pkt_set_speed d;
 	struct hj_pkt_pid_k e;
+	struct hjb_pkt_req_stats f;
+	struct hja_pkt_stats g;
+	struct hjb_pkt_req_credit h;
+	struct hja_pkt_credit i;
+	struct hjb_pkt_req_info_delta j;
+	struct hja_pkt_info_delta k;
+	struct hjb_pkt_set_line l;
+	struct hja_pkt_line m;
+	struct hjb_pkt_subscribe n;
+	struct hja_pkt_stream o;
+	struct hjb_pkt_set_speed_info p;
+	struct hjb_pkt_req_fields q;
+	struct hja_pkt_fields r;
+	struct hjb_pkt_sync s;
+	struct hja_pkt_sync t;
+	struct hj_pkt_echo u;
 };
 
 enum hj_pkt_len {
@@ -91,6 +312,37 @@ enum hj_pkt_len {
 
 	HJ_PL_PID_K = sizeof(struct hj_pkt_pid_k),
 
+	HJB_PL_REQ_STATS = sizeof(struct hjb_pkt_req_stats),
+	HJA_PL_STATS = sizeof(struct hja_pkt_stats),
+
+	HJB_PL_REQ_CREDIT = sizeof(struct hjb_pkt_req_credit),
+	HJA_PL_CREDIT = sizeof(struct hja_pkt_credit),
+
+	HJB_PL_REQ_INFO_DELTA = sizeof(struct hjb_pkt_req_info_delta),
+	/* the longest, the shortest has a byte for each field */
+	HJA_PL_INFO_DELTA = sizeof(struct hja_pkt_info_delta),
+	HJA_PL_INFO_DELTA_MIN = offsetof(struct hja_pkt_info_delta, v)
+		+ HJ_DELTA_FIELDS,
+
+	HJB_PL_SET_LINE = sizeof(struct hjb_pkt_set_line),
+	HJA_PL_LINE = sizeof(struct hja_pkt_line),
+
+	HJB_PL_SUBSCRIBE = sizeof(struct hjb_pkt_subscribe),
+	HJA_PL_STREAM = sizeof(struct hja_pkt_stream),
+
+	HJB_PL_SET_SPEED_INFO = sizeof(struct hjb_pkt_set_speed_info),
+
+	HJB_PL_REQ_FIELDS = sizeof(struct hjb_pkt_req_fields),
+	/* the longest, the shortest has no fields at all */
+	HJA_PL_FIELDS = sizeof(struct hja_pkt_fields),
+	HJA_PL_FIELDS_MIN = offsetof(struct hja_pkt_fields, v),
+
+	HJB_PL_SYNC = sizeof(struct hjb_pkt_sync),
+	HJA_PL_SYNC = sizeof(struct hja_pkt_sync),
+
+	/* the longest, data may be any shorter */
+	HJ_PL_ECHO = sizeof(struct hj_pkt_echo),
+
 	HJ_PL_MIN = sizeof(struct hj_pkt_header),
 	HJ_PL_MAX = sizeof(union hj_pkt_union)
 };
@@ -105,7 +357,32 @@ enum hj_pkt_type {
 	HJB_PT_PID_SAVE,
 	HJB_PT_PID_REQ,
 
-	HJ_PT_PID_K
+	HJ_PT_PID_K,
+
+	HJB_PT_REQ_STATS,
+	HJA_PT_STATS,
+
+	HJB_PT_REQ_CREDIT,
+	HJA_PT_CREDIT,
+
+	HJB_PT_REQ_INFO_DELTA,
+	HJA_PT_INFO_DELTA,
+
+	HJB_PT_SET_LINE,
+	HJA_PT_LINE,
+
+	HJB_PT_SUBSCRIBE,
+	HJA_PT_STREAM,
+
+	HJB_PT_SET_SPEED_INFO,
+
+	HJB_PT_REQ_FIELDS,
+	HJA_PT_FIELDS,
+
+	HJB_PT_SYNC,
+	HJA_PT_SYNC,
+
+	HJ_PT_ECHO
 };
 
 #define HJB_PKT_REQ_INFO_INITIALIZER { .type = HJB_PT_REQ_INFO }
@@ -114,11 +391,39 @@ enum hj_pkt_type {
 
 #define HJ_PKT_PID_K_INITIALIZER { .head = { .type = HJ_PT_PID_K } }
 #define HJA_PKT_INFO_INITIALIZER { .head = { .type = HJA_PT_INFO } }
+#define HJB_PKT_REQ_STATS_INITIALIZER(fl)			\
+	{ .head = { .type = HJB_PT_REQ_STATS }, .flags = (fl) }
+#define HJB_PKT_REQ_CREDIT_INITIALIZER(tok)			\
+	{ .head = { .type = HJB_PT_REQ_CREDIT }, .token = (tok) }
+#define HJA_PKT_CREDIT_INITIALIZER(tok, c)			\
+	{ .head = { .type = HJA_PT_CREDIT }, .token = (tok),	\
+		.seen = (c).seen, .free_pkts = (c).free_pkts,	\
+		.free_bytes = (c).free_bytes }
+#define HJB_PKT_REQ_INFO_DELTA_INITIALIZER(fl, a)		\
+	{ .head = { .type = HJB_PT_REQ_INFO_DELTA },		\
+		.flags = (fl), .ack = (a) }
+#define HJB_PKT_SET_LINE_INITIALIZER(b, fl)			\
+	{ .head = { .type = HJB_PT_SET_LINE },			\
+		.baud = htonl(b), .flags = (fl) }
+#define HJA_PKT_LINE_INITIALIZER(b, fl)				\
+	{ .head = { .type = HJA_PT_LINE },			\
+		.baud = htonl(b), .flags = (fl) }
+#define HJB_PKT_SUBSCRIBE_INITIALIZER(p)			\
+	{ .head = { .type = HJB_PT_SUBSCRIBE }, .period = (p) }
+#define HJB_PKT_REQ_FIELDS_INITIALIZER(f, m)			\
+	{ .head = { .type = HJB_PT_REQ_FIELDS },		\
+		.fields = (f), .motors = (m) }
+#define HJB_PKT_SYNC_INITIALIZER(h)				\
+	{ .head = { .type = HJB_PT_SYNC }, .host = htonl(h) }
+#define HJ_PKT_ECHO_INITIALIZER { .head = { .type = HJ_PT_ECHO } }
 
 #define HJA_PKT_ERROR_INITIALIZER(err) { .head = { .type = HJA_PT_ERROR }, \
 	.line = htons(__LINE__), .file = __FILE__, .errnum = htons(err) }
 #define HJB_PKT_SET_SPEED_INITIALIZER(a,b)		\
 	{ .head = { .type = HJB_PT_SET_SPEED},		\
 		.vel = { htons(a), htons(b) } }
+#define HJB_PKT_SET_SPEED_INFO_INITIALIZER(a,b)		\
+	{ .head = { .type = HJB_PT_SET_SPEED_INFO},	\
+		.vel = { htons(a), htons(b) } }
 
 #endif
@@ -0,0 +1,242 @@
+/*
+ * bench - time the host framing code, printing the results as JSON so runs
+ *         from different commits can be compared.
+ *
+ * usage: bench [min_ms_per_case]
+ *
+ * ns_per_byte is per payload byte for the crc and send cases, and per byte
+ * of the encoded stream for the receive cases.
+ *
+ * Build with optimization for meaningful numbers, ie:
+ *   make bench CFLAGS=-O2
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <errno.h>
+
+#include <unistd.h>
+#include <fcntl.h>
+#include <arpa/inet.h>
+
+#include "crc.h"
+#include "frame_async.h"
+#include "frame_codec.h"
+#include "now.h"
+#include "../hj_proto.h"
+
+#define STREAM_FRAMES 4096
+
+struct payload {
+	const char *name;
+	uint8_t data[256];
+	size_t len;
+};
+
+static struct payload payloads[4];
+static size_t payload_ct;
+
+static uint64_t min_ns = 200 * 1000 * 1000;
+static volatile uint16_t sink;
+static bool first_result = true;
+
+static void result(const char *op, const char *payload, uint64_t ns,
+		uint64_t bytes, uint64_t frames)
+{
+	printf("%s\n    { \"op\": \"%s\", \"payload\": \"%s\", "
+			"\"ns_per_byte\": %.3f, \"frames_per_s\": %.0f }",
+			first_result ? "" : ",", op, payload,
+			(double)ns / bytes,
+			frames * 1e9 / ns);
+	first_result = false;
+}
+
+static void payloads_init(void)
+{
+	struct payload *p;
+	size_t i;
+
+	/* a plausible reply to HJB_PT_REQ_INFO, big-endian counters */
+	p = &payloads[payload_ct++];
+	p->name = "hja_pkt_info";
+	struct hja_pkt_info info = HJA_PKT_INFO_INITIALIZER;
+	info.m[0].current = htons(0x0123);
+	info.m[0].e.p = htonl(0x00017d42);
+	info.m[0].e.n = htonl(0x00007e11);
+	info.m[0].e.l = htons(0x0012);
+	info.m[0].pwr = htons(0x3a7f);
+	info.m[1] = info.m[0];
+	memcpy(p->data, &info, sizeof(info));
+	p->len = sizeof(info);
+
+	p = &payloads[payload_ct++];
+	p->name = "hj_pkt_pid_k";
+	struct hj_pkt_pid_k k = HJ_PKT_PID_K_INITIALIZER;
+	k.k[0].p = htonl(0xff0);
+	k.k[0].i = htonl(0x7d);
+	k.k[0].d = htonl(0);
+	k.k[0].i_max = htons(0x7fff);
+	k.k[1] = k.k[0];
+	memcpy(p->data, &k, sizeof(k));
+	p->len = sizeof(k);
+
+	/* worst case, every byte must be escaped */
+	p = &payloads[payload_ct++];
+	p->name = "all_escape_64";
+	memset(p->data, FRAME_START, 64);
+	p->len = 64;
+
+	p = &payloads[payload_ct++];
+	p->name = "random_256";
+	for (i = 0; i < 256; i++)
+		p->data[i] = rand();
+	p->len = 256;
+}
+
+static void bench_crc(struct payload *p)
+{
+	uint64_t start = now_ns(), t, n = 0;
+	uint16_t crc = FRAME_CRC_INIT;
+
+	do {
+		size_t i;
+		for (i = 0; i < p->len; i++)
+			crc = crc_ccitt_update(crc, p->data[i]);
+		n++;
+	} while ((t = now_ns() - start) < min_ns);
+	sink = crc;
+	result("crc_ccitt_update", p->name, t, n * p->len, n);
+
+	start = now_ns();
+	n = 0;
+	do {
+		crc = crc_ccitt_block(crc, p->data, p->len);
+		n++;
+	} while ((t = now_ns() - start) < min_ns);
+	sink = crc;
+	result("crc_ccitt_block", p->name, t, n * p->len, n);
+}
+
+static void bench_send(struct payload *p)
+{
+	FILE *out = fopen("/dev/null", "w");
+	if (!out) {
+		perror("/dev/null");
+		exit(EXIT_FAILURE);
+	}
+
+	uint64_t start = now_ns(), t, n = 0;
+	do {
+		frame_send(out, p->data, p->len);
+		n++;
+	} while ((t = now_ns() - start) < min_ns);
+	result("frame_send", p->name, t, n * p->len, n);
+
+	fclose(out);
+}
+
+/*
+ * stream_mk - encode STREAM_FRAMES copies of @p, corrupting the crc of every
+ *             @corrupt'th frame (if non-zero).
+ */
+static uint8_t *stream_mk(struct payload *p, unsigned corrupt, size_t *len)
+{
+	size_t max = STREAM_FRAMES * FRAME_ENC_MAX(p->len);
+	uint8_t *s = malloc(max);
+	size_t l = 0;
+	unsigned i;
+
+	if (!s) {
+		perror("malloc");
+		exit(EXIT_FAILURE);
+	}
+
+	for (i = 0; i < STREAM_FRAMES; i++) {
+		ssize_t r = frame_encode(s + l, max - l, p->data, p->len);
+		if (corrupt && !(i % corrupt)) {
+			/* the byte before the closing flag belongs to the
+			 * crc */
+			s[l + r - 2] ^= 0x01;
+		}
+		l += r;
+	}
+
+	*len = l;
+	return s;
+}
+
+static void bench_recv(struct payload *p, unsigned corrupt, const char *name)
+{
+	size_t len;
+	uint8_t *s = stream_mk(p, corrupt, &len);
+	uint8_t buf[HJ_PL_MAX + 256];
+	uint64_t start, t, n = 0, frames = 0;
+
+	/* frame_recv reports every bad crc on stderr */
+	int err = dup(2), null = open("/dev/null", O_WRONLY);
+	dup2(null, 2);
+
+	start = now_ns();
+	do {
+		FILE *in = fmemopen(s, len, "r");
+		while (frame_recv(in, buf, sizeof(buf)) >= 0)
+			frames++;
+		fclose(in);
+		n++;
+	} while ((t = now_ns() - start) < min_ns);
+	result("frame_recv", name, t, n * len, frames);
+
+	dup2(err, 2);
+	close(err);
+	close(null);
+
+	static uint8_t dbuf[8192];
+	struct frame_dec fd;
+	frame_dec_init(&fd, dbuf, sizeof(dbuf));
+	frames = 0;
+	n = 0;
+	start = now_ns();
+	do {
+		size_t off = 0;
+		while (off < len) {
+			struct frame_span f;
+			off += frame_dec_feed(&fd, s + off, len - off);
+			while (frame_dec_next(&fd, &f))
+				frames++;
+		}
+		n++;
+	} while ((t = now_ns() - start) < min_ns);
+	result("frame_dec", name, t, n * len, frames);
+
+	free(s);
+}
+
+int main(int argc, char **argv)
+{
+	size_t i;
+
+	if (argc > 1)
+		min_ns = strtoull(argv[1], NULL, 0) * 1000 * 1000;
+
+	srand(1);
+	payloads_init();
+
+	printf("{\n  \"version\": \"%s\",\n  \"results\": [", VERSION);
+
+	for (i = 0; i < payload_ct; i++) {
+		struct payload *p = &payloads[i];
+		char name[64];
+
+		bench_crc(p);
+		bench_send(p);
+		bench_recv(p, 0, p->name);
+
+		snprintf(name, sizeof(name), "%s+crc_err_1_in_4", p->name);
+		bench_recv(p, 4, name);
+	}
+
+	printf("\n  ]\n}\n");
+	return 0;
+}
@@ -0,0 +1,156 @@
+/*
+ * burst - send SET_SPEED commands to a FRAME_CREDIT board as fast as its
+ *         receive queue frees up, then report the rate and the board's drop
+ *         counts (which should not have moved).
+ *
+ * usage: burst <file> <count> [vel_a vel_b]
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <arpa/inet.h>
+
+#include "fcb.h"
+#include "credit.h"
+#include "term_open.h"
+#include "error_m.h"
+#include "hj_print.h"
+#include "now.h"
+#include "../hj_proto.h"
+
+/* for the stats reply */
+#define STATS_WAIT_MS 1000
+
+static fcb_ctx fcb;
+static struct credit cr;
+static struct hja_pkt_stats stats;
+static bool have_stats;
+
+static int queue(const void *data, size_t len)
+{
+	for (;;) {
+		ssize_t r = fcb_queue(&fcb, data, len);
+		if (r != -EAGAIN)
+			return r < 0 ? r : 0;
+		r = fcb_advance_wait(&fcb, -1);
+		if (r < 0)
+			return r;
+	}
+}
+
+static int recv_all(void)
+{
+	uint8_t buf[HJ_PL_MAX];
+	ssize_t l;
+
+	while ((l = fcb_recv(&fcb, buf, sizeof(buf))) > 0) {
+		if (buf[0] == HJA_PT_CREDIT && l == HJA_PL_CREDIT) {
+			credit_update(&cr, (struct hja_pkt_credit *)buf);
+		} else if (buf[0] == HJA_PT_STATS && l == HJA_PL_STATS) {
+			memcpy(&stats, buf, sizeof(stats));
+			have_stats = true;
+		}
+	}
+	return l;
+}
+
+/* send a packet once the board has room for it */
+static int send_paced(const void *data, size_t len)
+{
+	while (!credit_ok(&cr, len)) {
+		uint8_t tok = credit_probe(&cr);
+		if (tok) {
+			struct hjb_pkt_req_credit req =
+				HJB_PKT_REQ_CREDIT_INITIALIZER(tok);
+			int r = queue(&req, HJB_PL_REQ_CREDIT);
+			if (r < 0)
+				return r;
+			credit_sent(&cr, HJB_PL_REQ_CREDIT);
+		}
+
+		int r = fcb_advance_wait(&fcb, 10);
+		if (r < 0)
+			return r;
+		r = recv_all();
+		if (r < 0)
+			return r;
+	}
+
+	int r = queue(data, len);
+	if (r < 0)
+		return r;
+	credit_sent(&cr, len);
+	return fcb_advance_wait(&fcb, 0);
+}
+
+int main(int argc, char **argv)
+{
+	if (argc != 3 && argc != 5) {
+		fprintf(stderr, "usage: %s <file> <count> [vel_a vel_b]\n",
+				argc?argv[0]:"burst");
+		return 2;
+	}
+
+	long count = strtol(argv[2], NULL, 0);
+	int16_t va = 0, vb = 0;
+	if (argc == 5) {
+		va = strtol(argv[3], NULL, 0);
+		vb = strtol(argv[4], NULL, 0);
+	}
+
+	FILE *sf = term_open(argv[1]);
+	if (!sf) {
+		ERROR("open: %s", strerror(errno));
+		return 1;
+	}
+
+	int r = fcb_open(&fcb, fileno(sf));
+	if (r < 0) {
+		ERROR("%s", strerror(-r));
+		return 1;
+	}
+
+	credit_init(&cr);
+
+	struct hjb_pkt_set_speed ss = HJB_PKT_SET_SPEED_INITIALIZER(va, vb);
+	uint64_t start = now_ms();
+	long i;
+	for (i = 0; i < count; i++) {
+		r = send_paced(&ss, HJB_PL_SET_SPEED);
+		if (r < 0)
+			goto err;
+	}
+
+	struct hjb_pkt_req_stats rs = HJB_PKT_REQ_STATS_INITIALIZER(0);
+	r = send_paced(&rs, HJB_PL_REQ_STATS);
+	if (r < 0)
+		goto err;
+
+	uint64_t end = now_ms();
+	while (!have_stats && now_ms() - end < STATS_WAIT_MS) {
+		r = fcb_advance_wait(&fcb, 10);
+		if (r < 0)
+			goto err;
+		r = recv_all();
+		if (r < 0)
+			goto err;
+	}
+
+	uint64_t ms = end - start;
+	printf("%ld frames in %llu ms (%.1f/s)  waits %lu probes %lu\n",
+			count, (unsigned long long)ms,
+			ms ? count * 1000.0 / ms : 0.0, cr.waits, cr.probes);
+	if (!have_stats) {
+		ERROR("no stats reply");
+		return 1;
+	}
+	hj_print_stats(&stats, stdout);
+	putchar('\n');
+	return 0;
+
+err:
+	ERROR("%s", strerror(-r));
+	return 1;
+}
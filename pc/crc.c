@@ -0,0 +1,186 @@
+#include <stdint.h>
+#include <stddef.h>
+
+#include "crc.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+# define CRC_HAVE_CLMUL 1
+# include <immintrin.h>
+#endif
+
+/*
+ * crc_tab[k][b] - the crc contribution of byte `b` when it is followed by `k`
+ *                 more bytes. crc_tab[0] is the classic byte-at-a-time table,
+ *                 the rest allow 8 bytes to be folded in per step.
+ *
+ *                 Generated from crc_ccitt_update() so the block routines can
+ *                 never drift from the byte routine.
+ */
+static uint16_t crc_tab[8][256];
+
+static void crc_tab_init(void)
+{
+	unsigned i, k;
+	for (i = 0; i < 256; i++)
+		crc_tab[0][i] = crc_ccitt_update(0, i);
+
+	for (k = 1; k < 8; k++) {
+		for (i = 0; i < 256; i++) {
+			uint16_t p = crc_tab[k - 1][i];
+			crc_tab[k][i] = (p >> 8) ^ crc_tab[0][p & 0xff];
+		}
+	}
+}
+
+static inline
+uint16_t crc_tab_byte(uint16_t crc, uint8_t b)
+{
+	return (crc >> 8) ^ crc_tab[0][(crc ^ b) & 0xff];
+}
+
+uint16_t crc_ccitt_block_slice8(uint16_t crc, const void *buf, size_t len)
+{
+	const uint8_t *p = buf;
+
+	while (len >= 8) {
+		crc ^= p[0] | (p[1] << 8);
+		crc = crc_tab[7][crc & 0xff] ^ crc_tab[6][crc >> 8]
+			^ crc_tab[5][p[2]] ^ crc_tab[4][p[3]]
+			^ crc_tab[3][p[4]] ^ crc_tab[2][p[5]]
+			^ crc_tab[1][p[6]] ^ crc_tab[0][p[7]];
+		p += 8;
+		len -= 8;
+	}
+
+	while (len--)
+		crc = crc_tab_byte(crc, *p++);
+
+	return crc;
+}
+
+#ifdef CRC_HAVE_CLMUL
+/*
+ * The data is treated as a polynomial over GF(2) with bit 0 of the first byte
+ * as the highest degree term (the crc is "reflected"), so a 16 byte chunk
+ * loaded little-endian into an xmm register holds x^127 in bit 0.
+ *
+ * Folding replaces a chunk X that sits D bits ahead of another chunk with
+ * (X * x^D mod P), which leaves the final crc unchanged. Each 64 bit half of X
+ * is multiplied by a 16 bit constant, so the product fits back into 128 bits.
+ * A carry-less multiply of two reflected 64 bit values comes out one bit
+ * short, hence the constants are x^(D+63) and x^(D-1) rather than x^(D+64)
+ * and x^D.
+ *
+ * Once everything is folded into one register its 16 bytes (plus whatever
+ * tail did not fill a chunk) are run through the table code to finish.
+ */
+struct crc_fold_k {
+	__m128i k512;
+	__m128i k128;
+};
+
+static struct crc_fold_k crc_fold;
+
+/*
+ * crc_xpow - x^n mod P in the layout expected by the fold constants (a
+ *            reflected 16 bit value in the top of a 64 bit lane).
+ *
+ *            The crc of a message whose only set bit is its first is
+ *            x^(bits - 1) * x^16 mod P, so let the table code do the work.
+ */
+static uint64_t crc_xpow(unsigned n)
+{
+	uint8_t m[128] = { 0x01 };
+	size_t len = (n - 15) / 8;
+
+	return (uint64_t)crc_ccitt_block_slice8(0, m, len) << 48;
+}
+
+__attribute__((target("sse2")))
+static void crc_fold_init(void)
+{
+	crc_fold.k512 = _mm_set_epi64x(crc_xpow(511), crc_xpow(575));
+	crc_fold.k128 = _mm_set_epi64x(crc_xpow(127), crc_xpow(191));
+}
+
+__attribute__((target("pclmul,sse2")))
+static inline __m128i crc_fold_16(__m128i x, __m128i k)
+{
+	__m128i a = _mm_clmulepi64_si128(x, k, 0x00);
+	__m128i b = _mm_clmulepi64_si128(x, k, 0x11);
+	return _mm_xor_si128(a, b);
+}
+
+__attribute__((target("pclmul,sse2")))
+static uint16_t crc_ccitt_block_clmul(uint16_t crc, const void *buf,
+		size_t len)
+{
+	const uint8_t *p = buf;
+	uint8_t rem[16];
+
+	if (len < 64)
+		return crc_ccitt_block_slice8(crc, buf, len);
+
+	__m128i k = crc_fold.k512;
+	__m128i x0 = _mm_loadu_si128((const __m128i *)(p +  0));
+	__m128i x1 = _mm_loadu_si128((const __m128i *)(p + 16));
+	__m128i x2 = _mm_loadu_si128((const __m128i *)(p + 32));
+	__m128i x3 = _mm_loadu_si128((const __m128i *)(p + 48));
+
+	/* the initial crc is simply xored into the first 2 bytes */
+	x0 = _mm_xor_si128(x0, _mm_cvtsi32_si128(crc));
+	p += 64;
+	len -= 64;
+
+	while (len >= 64) {
+		x0 = _mm_xor_si128(crc_fold_16(x0, k),
+				_mm_loadu_si128((const __m128i *)(p +  0)));
+		x1 = _mm_xor_si128(crc_fold_16(x1, k),
+				_mm_loadu_si128((const __m128i *)(p + 16)));
+		x2 = _mm_xor_si128(crc_fold_16(x2, k),
+				_mm_loadu_si128((const __m128i *)(p + 32)));
+		x3 = _mm_xor_si128(crc_fold_16(x3, k),
+				_mm_loadu_si128((const __m128i *)(p + 48)));
+		p += 64;
+		len -= 64;
+	}
+
+	k = crc_fold.k128;
+	x1 = _mm_xor_si128(crc_fold_16(x0, k), x1);
+	x2 = _mm_xor_si128(crc_fold_16(x1, k), x2);
+	x0 = _mm_xor_si128(crc_fold_16(x2, k), x3);
+
+	while (len >= 16) {
+		x0 = _mm_xor_si128(crc_fold_16(x0, k),
+				_mm_loadu_si128((const __m128i *)p));
+		p += 16;
+		len -= 16;
+	}
+
+	_mm_storeu_si128((__m128i *)rem, x0);
+	crc = crc_ccitt_block_slice8(0, rem, sizeof(rem));
+	return crc_ccitt_block_slice8(crc, p, len);
+}
+#endif /* CRC_HAVE_CLMUL */
+
+static uint16_t (*crc_block_impl)(uint16_t crc, const void *buf, size_t len)
+	= crc_ccitt_block_slice8;
+
+__attribute__((constructor))
+static void crc_init(void)
+{
+	crc_tab_init();
+
+#ifdef CRC_HAVE_CLMUL
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("pclmul")) {
+		crc_fold_init();
+		crc_block_impl = crc_ccitt_block_clmul;
+	}
+#endif
+}
+
+uint16_t crc_ccitt_block(uint16_t crc, const void *buf, size_t len)
+{
+	return crc_block_impl(crc, buf, len);
+}
@@ -2,6 +2,7 @@
 #define CRC_H_
 
 #include <stdint.h>
+#include <stddef.h>
 
 #if 1
 static inline
@@ -39,4 +40,15 @@ uint16_t crc_ccitt_update(uint16_t crc, uint8_t data)
 }
 #endif
 
+/*
+ * crc_ccitt_block - crc_ccitt_update() applied to each byte of @buf in turn.
+ *
+ * The fastest implementation the cpu supports (carry-less multiply folding
+ * or slice-by-8 tables) is selected at startup; all give identical results.
+ */
+uint16_t crc_ccitt_block(uint16_t crc, const void *buf, size_t len);
+
+/* the portable table driven implementation used by crc_ccitt_block */
+uint16_t crc_ccitt_block_slice8(uint16_t crc, const void *buf, size_t len);
+
 #endif
@@ -0,0 +1,84 @@
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+
+#include "credit.h"
+#include "now.h"
+
+#define MIN(a, b) ((a) < (b) ? (a) : (b))
+
+void credit_init(struct credit *c)
+{
+	memset(c, 0, sizeof(*c));
+}
+
+bool credit_ok(struct credit *c, size_t len)
+{
+	/* until a request is answered, nothing we send is accounted for */
+	if (c->known && !c->token) {
+		uint8_t n = c->sent - c->seen;
+		size_t bytes = CREDIT_CHARGE(len);
+		uint8_t i;
+
+		for (i = c->seen; i != c->sent; i++)
+			bytes += c->charge[i];
+
+		if (n < c->free_pkts && bytes <= c->free_bytes)
+			return true;
+	}
+
+	c->waits++;
+	return false;
+}
+
+void credit_sent(struct credit *c, size_t len)
+{
+	c->charge[c->sent] = MIN(CREDIT_CHARGE(len), UINT8_MAX);
+	c->sent++;
+	c->active_ms = now_ms();
+}
+
+uint8_t credit_probe(struct credit *c)
+{
+	uint64_t now = now_ms();
+
+	/* the first is asked at once, after that only when stuck (or when
+	 * the request or its reply went missing) */
+	if ((c->known || c->token) && now - c->active_ms < CREDIT_PROBE_MS)
+		return 0;
+
+	c->next_token = c->next_token % UINT8_MAX + 1;
+	c->token = c->next_token;
+	c->active_ms = now;
+	c->probes++;
+	return c->token;
+}
+
+void credit_update(struct credit *c, const struct hja_pkt_credit *p)
+{
+	if (p->token) {
+		/* an older request's */
+		if (p->token != c->token)
+			return;
+
+		/* nothing is sent while it is outstanding, so the board
+		 * has had the chance to see everything we have sent */
+		c->token = 0;
+		c->known = true;
+		c->seen = c->sent;
+		c->off = p->seen - c->sent;
+	} else {
+		if (!c->known)
+			return;
+
+		uint8_t seen = p->seen - c->off;
+		/* from before the last report */
+		if ((uint8_t)(seen - c->seen) > (uint8_t)(c->sent - c->seen))
+			return;
+		c->seen = seen;
+	}
+
+	c->free_pkts = p->free_pkts;
+	c->free_bytes = p->free_bytes;
+	c->active_ms = now_ms();
+}
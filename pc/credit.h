@@ -0,0 +1,84 @@
+#ifndef HJ_PC_CREDIT_H_
+#define HJ_PC_CREDIT_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#include <frame/frame_proto.h>
+
+#include "../hj_proto.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * credit - pace the frames sent to a board built with FRAME_CREDIT so they
+ *          never overrun its receive queue.
+ *
+ * The board's HJA_PT_CREDIT packets give the room its queue had left, and
+ * how many frames it had received by then (seen). Every frame sent after
+ * those is charged against that room until a later report covers it.
+ *
+ * The board counts from boot, so its count is first lined up with ours by
+ * a HJB_PT_REQ_CREDIT: its reply has seen every frame sent before it.
+ * Frames lost on the line are never seen, and stay charged. When nothing
+ * may be sent for CREDIT_PROBE_MS, the request is made again, which writes
+ * them off.
+ *
+ * Frames to FRAME_ADDR_BCAST are taken by every board, and are not
+ * accounted for: send none while using this.
+ *
+ * Usage:
+ *   credit_init(), then for each frame: while !credit_ok(), send the
+ *   HJB_PT_REQ_CREDIT credit_probe() asks for (if any) and pass every
+ *   HJA_PT_CREDIT received to credit_update(). Once it may go, send it
+ *   and call credit_sent(). Requests are sent (and credit_sent()) without
+ *   asking credit_ok().
+ */
+
+#define CREDIT_PROBE_MS 100
+
+/* room a frame of len bytes (as framed, address and control included)
+ * takes in the board's queue */
+#define CREDIT_CHARGE(len) ((len) + FRAME_CRC_SZ + 1)
+
+struct credit {
+	uint8_t sent;		/* frames sent, wraps */
+	uint8_t seen;		/* of those, seen at the last report */
+	uint8_t off;		/* the board's count less ours */
+	uint8_t free_pkts;
+	uint8_t free_bytes;
+	bool known;		/* off is, ie: a request has been answered */
+
+	uint8_t token;		/* of the request outstanding, or 0 */
+	uint8_t next_token;
+	uint64_t active_ms;	/* last frame sent, or report taken */
+
+	/* CREDIT_CHARGE of each frame, by number */
+	uint8_t charge[256];
+
+	unsigned long probes;
+	unsigned long waits;	/* credit_ok() said no */
+};
+
+void credit_init(struct credit *c);
+
+/* return: true if a frame of @len bytes may be sent now */
+bool credit_ok(struct credit *c, size_t len);
+
+/* count a frame of @len bytes as sent */
+void credit_sent(struct credit *c, size_t len);
+
+/* return: the token to send in a HJB_PT_REQ_CREDIT now, or 0 for none */
+uint8_t credit_probe(struct credit *c);
+
+/* take a report from the board */
+void credit_update(struct credit *c, const struct hja_pkt_credit *p);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -1,73 +1,58 @@
 #include <stdint.h>
 #include <stdbool.h>
+#include <string.h>
+#include <errno.h>
 
-/**
- * container_of - cast a member of a structure out to the containing structure
- * @ptr:	the pointer to the member.
- * @type:	the type of the container struct this is embedded in.
- * @member:	the name of the member within the struct.
- *
- */
-#define container_of(ptr, type, member) ({			\
-	const typeof( ((type *)0)->member ) *__mptr = (ptr);	\
-	(type *)( (char *)__mptr - offsetof(type,member) );})
-
-struct list_head {
-	struct list_head *prev, *next;
-};
-
-typedef struct fcb_pkt {
-	struct list_head list;
-	size_t mem_len;
-	size_t cur_pos;
-	uint8_t data[];
-} fcb_pkt;
-
-#define pkt_from_list(list) container_of(list, struct fcb_pkt, list)
-
-struct fcb_ctx_in {
-	bool start;
-	bool esc;
-	uint16_t crc;
-	struct fcb_pkt *cur_pkt;
-	struct list_head pkts;
-};
-
-struct fcb_ctx_out {
-	struct list_head pkts;
-};
-
-typedef struct fcb_ctx {
-	int fd;
-	struct fcb_ctx_out out;
-	struct fcb_ctx_in in;
-} fcb_ctx;
-
-static void ctx_out_open(struct fcb_ctx_out *ci)
+#include <unistd.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/uio.h>
+
+#include "frame_codec.h"
+#include "list.h"
+#include "fcb.h"
+
+#define MIN(a, b) ((a) < (b) ? (a) : (b))
+
+#define TX_MASK (FCB_TX_SZ - 1)
+#define TX_CNT(oc)   ((oc)->head - (oc)->tail)
+#define TX_SPACE(oc) (FCB_TX_SZ - TX_CNT(oc))
+
+static void ctx_out_open(struct fcb_ctx_out *co)
 {
-	list_head_init(&ci->pkts);
+	co->head = 0;
+	co->tail = 0;
 }
 
 static void ctx_in_open(struct fcb_ctx_in *ci)
 {
-	ci->start = false;
-	ci->esc = false;
-	ci->crc = CRC_INIT;
-	ci->cur_pkt = NULL;
+	size_t i;
+
+	frame_dec_init(&ci->dec, ci->buf, sizeof(ci->buf));
 
 	list_head_init(&ci->pkts);
+	list_head_init(&ci->free);
+	for (i = 0; i < FCB_PKT_CT; i++)
+		list_add_tail(&ci->pool[i].list, &ci->free);
+
+	ci->dropped = 0;
 }
 
 /*
  * fcb_open - initalizes the given ctx with the given fd.
  *
  * @ctx - an opened ctx
- * @fd  - a file descriptor which supports poll, read, and write.
+ * @fd  - a file descriptor which supports poll, read, and write. It is
+ *        switched to non-blocking mode.
  *
  * return - failure <0, success 0.
  */
 int fcb_open(struct fcb_ctx *ctx, int fd)
 {
+	int fl = fcntl(fd, F_GETFL);
+	if (fl < 0 || fcntl(fd, F_SETFL, fl | O_NONBLOCK) < 0)
+		return -errno;
+
 	ctx->fd = fd;
 
 	ctx_in_open(&ctx->in);
@@ -77,93 +62,33 @@ int fcb_open(struct fcb_ctx *ctx, int fd)
 }
 
 /*
- * clean_pkt - takes the raw packet `in_pkt` and extracts a single packet from
- *             it, starting processing at cur_pos. `in_pkt` is then modified
- *             with a new cur pos for where this processing left off.
- *
- *             If it finds that no new packets can be extracted, it
- *             reposistions the still raw data at the beginning of the buffer
- *             and fixes up the counts.
- *
- * @in_pkt: input packet with raw data populating `data`. Requires `cur_pos` be set
- *          to the posistion where parsing should begin.
- *
- * return:  when a new packet has been created: 0.
- *          when no more packets can be make and no packet has been made: 1.
- *          error: <0.
+ * in_pkt_store - move a decoded frame out of the decode buffer and into a
+ *                packet slot so the decode buffer may be reused.
  */
-static int clean_pkt(struct fcb_pkt *in_pkt, struct fcb_pkt **out_pkt)
+static void in_pkt_store(struct fcb_ctx_in *ic, struct frame_span *f)
 {
-	uint8_t buf[in_pkt->cur_len];
-	uint16_t crc = FRAME_CRC_INIT;
-	size_t i;
-	size_t j = 0;
-	bool esc = false;
-
-	/* find the first start byte */
-	for (i = 0; ; i++) {
-		if (i >= in_pkt->cur_len)
-			goto done;
-		if (in_pkt->buf[i] == FRAME_START)
-			break;
-	}
-
-	for (;; i++) {
-		uint8_t b = in_pkt->buf[i];
+	/* empty frames carry nothing for our users */
+	if (!f->len)
+		return;
 
-		switch(b) {
-		case FRAME_START:
-			/* TODO: packet done */
-			esc = false;
-			break;
-		case FRAME_ESC:
-			esc = true;
-			break;
-		case FRAME_CANCEL:
-			/* TODO: packet discard */
-			esc = false;
-			break;
-		default:
-			crc = crc_ccitt_update(crc, b);
-			if (esc) {
-				buf[j] = FRAME_ESC_MASK ^ b;
-			} else {
-				buf[j] = b;
-			}
-			esc = false;
-			j++;
-			break;
-		}
+	if (f->len > FCB_PKT_MAX || list_empty(&ic->free)) {
+		ic->dropped++;
+		return;
 	}
 
-	/* TODO: */
-	return -EINVAL;
-}
-
-/*
- * pkt_mk - allocate and intialize a fcb_pkt with data len = init_sz
- *
- * @init_sz - a suggestion for the size of the data[] in fcb_pkt.
- */
-static fcb_pkt *pkt_mk(size_t init_sz)
-{
-	fcb_pkt *p = malloc(sizeof(*p) + init_sz);
-	if (!p)
-		return p;
-
-	p->mem_len = init_sz;
-	p->cur_pos = 0;
+	struct fcb_pkt *p = list_first_entry(&ic->free, fcb_pkt, list);
+	list_del(&p->list);
 
-	list_head_init(&p->l);
+	memcpy(p->data, f->data, f->len);
+	p->len = f->len;
 
-	return p;
+	list_add_tail(&p->list, &ic->pkts);
 }
 
 /*
- * in_update - called when the fd has data waiting to be 'read'. Attempts to
- *             read ths data, either continuing an in progress packet and/or
- *             beginning a new one. When a packet is completed, it should be
- *             decoded and added to the queue.
+ * in_update - called when the fd has data waiting to be 'read'. Reads all
+ *             that is available, decoding any completed packets into the
+ *             queue.
  *
  * @ctx:    the fcb_ctx to operate on
  *
@@ -173,47 +98,37 @@ static int in_update(fcb_ctx *ctx)
 {
 	struct fcb_ctx_in *ic = &ctx->in;
 
-	/* do we currently have an in progress packet allocated? */
-	if (!ic->cur_pkt) {
-		ic->cur_pkt = pkt_mk(1024);
-		if (!ic->cur_pkt)
-			return -ENOMEM;
-	}
-
-	struct fcb_pkt *p = ic->cur_pkt;
-
-	ssize_t ret = read(ctx->fd, p->data + p->cur_pos, p->mem_len - p->cur_pos);
-
-	if (ret <= 0) {
-		/* TODO: some error occured, handle. */
-		return -1;
-	}
-
-	p->len += ret;
-
-	/* Keep processing while data remains in cur_pkt. */
-	for(;;) {
-		struct fcb_pkt *np
-		int r = clean_pkt(p, &np);
+	for (;;) {
+		size_t space;
+		uint8_t *p = frame_dec_space(&ic->dec, &space);
+
+		ssize_t ret = read(ctx->fd, p, space);
+		if (ret < 0) {
+			if (errno == EAGAIN || errno == EWOULDBLOCK)
+				return 0;
+			if (errno == EINTR)
+				continue;
+			return -errno;
+		}
 
-		if (r < 0)
-			return r;
-		if (r == 1) {
-			/* no more data to process */
-			break;
+		if (ret == 0) {
+			/* the other end went away */
+			return -EPIPE;
 		}
 
-		list_add(ic->pkts, np->list);
-	}
+		frame_dec_commit(&ic->dec, ret);
 
-	return 0;
+		struct frame_span f;
+		while (frame_dec_next(&ic->dec, &f))
+			in_pkt_store(ic, &f);
+	}
 }
 
 /*
  * out_update - called when we know the fd has the ability to accept data via
- *              'write'. If we have any data in the output queue, it attempts
- *              to write a single packet (or remainder of a packet) prior to
- *              returning.
+ *              'write'. Writes as much of the output ring as the fd will
+ *              take, the whole queue (both halves of the ring) being handed
+ *              over in one writev.
  *
  * @ctx - the fcb_ctx to operate on
  *
@@ -222,36 +137,29 @@ static int in_update(fcb_ctx *ctx)
 static int out_update(fcb_ctx *ctx)
 {
 	struct fcb_ctx_out *oc = &ctx->out;
-	if (list_empty(oc->l))
-		return 1;
-
-	fcb_pkt *cur = list_first_entry(&oc->pkts, fcb_pkt, list);
 
-	/* resume or begin writing out `cur' */
-
-	/* FIXME: if pkts has only this element, do not attempt to write
-	 * the embeded cancel byte (the last byte in data)
-	 */
-	ssize_t ret = write(ctx->fd, cur->data + cur->cur_pos,
-				cur->len - cur->cur_pos);
-
-	if (ret > 0) {
-		cur->cur_pos += ret;
-		if (cur->cur_pos == cur->len) {
-			/* TODO: remove `cur` from the packet list,
-			 * deallocate */
+	while (TX_CNT(oc)) {
+		size_t t = oc->tail & TX_MASK;
+		size_t cnt = TX_CNT(oc);
+		size_t l1 = MIN(cnt, FCB_TX_SZ - t);
+		struct iovec iov[2] = {
+			{ .iov_base = oc->buf + t, .iov_len = l1 },
+			{ .iov_base = oc->buf, .iov_len = cnt - l1 },
+		};
+
+		ssize_t ret = writev(ctx->fd, iov, iov[1].iov_len ? 2 : 1);
+		if (ret < 0) {
+			if (errno == EAGAIN || errno == EWOULDBLOCK)
+				return 0;
+			if (errno == EINTR)
+				continue;
+			return -errno;
 		}
-	} else if (ret < 0) {
-		/* FIXME: some type of error, handle. */
-		return -1;
-	}
 
-	return 0;
-}
+		oc->tail += ret;
+	}
 
-static int fcb_advance(struct fcb_ctx *ctx)
-{
-	return fcb_advance_wait(ctx, 0);
+	return 1;
 }
 
 /*
@@ -261,234 +169,176 @@ static int fcb_advance(struct fcb_ctx *ctx)
  *                    up to timeout amount.
  *
  * @ctx:     the fcb_ctx to operate upon.
- * @timeout: amound to time to wait for poll to complete. If <1, this indicates
- *           an infinite wait. Infinite waits are assumed to mean the caller is
- *           waiting for all output packets to be processed.
+ * @timeout: amount of time (in ms) to wait for the fd to become ready. <0 is
+ *           an infinite wait, 0 never waits.
  *
- * return - on error, < 1. On success 0.
+ * return - on error, < 0. On success 0.
  */
-static int fcb_advance_wait(struct fcb_ctx *ctx, int timeout )
+int fcb_advance_wait(struct fcb_ctx *ctx, int timeout)
 {
-	struct pollfd pfd = { ctx.fd, POLLOUT | POLLIN, 0 };
+	struct pollfd pfd = { .fd = ctx->fd };
 	for (;;) {
-		int r = poll(&pfd, 1, 0);
-		if (r > 0) {
-			/* we can do something */
-			if (pfd.revents & POLLNVAL) {
-				return -1;
-			}
-
-			if (pfd.revents & POLLERR) {
-				return -2;
-			}
-
-			if (pfd.revents & POLLHUP) {
-				return -3;
-			}
-
-			if (pfd.revents & POLLOUT) {
-				/* do output update */
-				int r = out_update(ctx);
-				if (r == 1) {
-					if (timeout < 0) {
-						/* infinite timeout
-						 * indicates we are waiting
-						 * for the output to empty.
-						 */
-						return 0;
-					} else {
-						pfd.events &= ~POLLOUT;
-					}
-				} else if (r) {
-					return r;
-				}
-			}
-
-			if (pfd.revents & POLLIN) {
-				/* do input update */
-				/* FIXME: return value? */
-				int r;
-				if ((r = in_update(ctx))) {
-					return r;
-				}
-			}
-		} else if (r < 0) {
-			/* error */
-			return r;
-		} else {
+		pfd.events = POLLIN;
+		if (TX_CNT(&ctx->out))
+			pfd.events |= POLLOUT;
+
+		int r = poll(&pfd, 1, timeout);
+		if (r < 0) {
+			if (errno == EINTR)
+				continue;
+			return -errno;
+		}
+
+		if (r == 0) {
 			/* can't do anything */
 			return 0;
 		}
+
+		if (pfd.revents & POLLNVAL)
+			return -EBADF;
+
+		if (pfd.revents & POLLERR)
+			return -EIO;
+
+		if (pfd.revents & POLLOUT) {
+			r = out_update(ctx);
+			if (r < 0)
+				return r;
+		}
+
+		/* a hangup is noticed by read returning 0 */
+		if (pfd.revents & (POLLIN | POLLHUP)) {
+			r = in_update(ctx);
+			if (r < 0)
+				return r;
+		}
+
+		/* we've waited once, now only take what is ready */
+		timeout = 0;
 	}
-	return 0;
+}
+
+static int fcb_advance(struct fcb_ctx *ctx)
+{
+	return fcb_advance_wait(ctx, 0);
 }
 
 /*
- * pkt_append - given an additional byte, add it to the end of a packet.
+ * fcb_queue - add a packet to the output ring without writing anything.
  *
- * @p - the packet to append the byte to.
- * @b - the byte to append
+ *             If the previous frame's closing flag has not yet been written
+ *             it also serves as this frame's opening flag, so a burst of
+ *             queued frames costs one flag per frame rather than two.
  *
- * return - the new fcb_pkt on success, NULL on error (with errno set).
+ * return - @nbytes on success, -EAGAIN when the output ring lacks space
+ *          for the frame (fcb_flush and retry), or another error <0.
  */
-static fcb_pkt *pkt_append(fcb_pkt *p, uint8_t b)
+ssize_t fcb_queue(struct fcb_ctx *ctx, const void *data, size_t nbytes)
 {
-	if (p->cur_pos >= p->mem_len) {
-		fcb_pkt *np = realloc(p, p->mem_len * 2);
-		if (!np)
-			return NULL;
-		p = np;
+	struct fcb_ctx_out *oc = &ctx->out;
+	size_t h = oc->head & TX_MASK;
+	size_t to_end = MIN(TX_SPACE(oc), FCB_TX_SZ - h);
+	ssize_t (*enc)(void *, size_t, const void *, size_t) =
+		TX_CNT(oc) ? frame_encode_cont : frame_encode;
+	ssize_t len;
+
+	if (to_end >= FRAME_ENC_MAX(nbytes)) {
+		/* common case, encode directly into the ring */
+		len = enc(oc->buf + h, to_end, data, nbytes);
+	} else {
+		/* the frame may wrap, or not fit at all */
+		uint8_t tmp[FRAME_ENC_MAX(nbytes)];
+		len = enc(tmp, sizeof(tmp), data, nbytes);
+		if (len < 0)
+			return len;
+		if ((size_t)len > TX_SPACE(oc))
+			return -EAGAIN;
+
+		size_t l1 = MIN((size_t)len, FCB_TX_SZ - h);
+		memcpy(oc->buf + h, tmp, l1);
+		memcpy(oc->buf, tmp + l1, len - l1);
 	}
 
-	p->data[p->cur_pos] = b;
-	p->cur_pos ++;
-	return p;
-}
+	if (len < 0)
+		return len;
 
-/*
- * PKT_ADD - try using pkt_append. On success, reassign the packet and return
- *           false.  on failure, return true without changing p
- */
-#define PKT_ADD(p, c) ({		\
-	bool fail = false;		\
-	fcb_pkt *np = pkt_append(p, c);	\
-	if (!np)			\
-		fail = true;		\
-	else				\
-		(p) = np;		\
-	fail; })
-
-/*
- * PKT_ADD_B - append data bytes (which need to be escaped) and reasign @p
- *             properly.
- */
-#define PKT_ADD_B(p, c) ({					\
-	bool fail = false;					\
-	if (FRAME_ESC_CHECK(c)) {				\
-		if (PKT_ADD(p, FRAME_ESC)) {			\
-			fail = true;				\
-		} else {					\
-			if (PKT_ADD(p, c ^ FRAME_ESC_MASK)) {	\
-				fail = true;			\
-			}					\
-		}						\
-	} else {						\
-		if (PKT_ADD(p, c)) {				\
-			fail = true;				\
-		}						\
-	}							\
-	fail;	})
+	oc->head += len;
+	return nbytes;
+}
 
 /*
- * convert_to_pkt - Take an outgoing data stream an make it a packet.
+ * fcb_send - queue a packet, and write out as much as possible.
  *
- * @data   - raw data to form into the contents of a packet.
- * @nbytes - the length of @data.
- *
- * return  - a fcb_pkt (heap allocated) with the copied contents of @data.
+ * return - as fcb_queue.
  */
-static fcb_pkt *convert_to_pkt(void *data, size_t nbytes)
+ssize_t fcb_send(struct fcb_ctx *ctx, const void *data, size_t nbytes)
 {
-	/* estimate the packet length. */
-	size_t elen = 2 + nbytes + nbytes / (256 / 3);
-
-	fcb_pkt *p = pkt_mk(elen);
-	if (!p)
-		return NULL;
-
-	uint8_t *d;
-	uint16_t crc = FRAME_CRC_INIT;
-
-	if (PKT_ADD(p, FRAME_START)) {
-		free(p);
-		return NULL;
-	}
+	ssize_t ret = fcb_queue(ctx, data, nbytes);
+	if (ret < 0)
+		return ret;
 
-	for (d = data; d < d + nbytes; d++) {
-		uint8_t c = *d;
-		if (FRAME_ESC_CHECK(c)) {
-			if PKT_ADD(p, FRAME_ESC) {
-				free(p);
-				return NULL;
-			}
-			c ^= FRAME_ESC_MASK;
-		}
-
-		crc = crc_ccitt_update(crc, c);
-		if PKT_ADD(p, c) {
-			free(p);
-			return NULL;
-		}
-	}
-
-	if PKT_ADD_B(p, crc >> 8) {
-		free(p);
-		return NULL;
-	}
-
-	if PKT_ADD_B(p, crc & 0xff) {
-		free(p);
-		return NULL;
-	}
-
-	if (PKT_ADD(p, FRAME_START)) {
-		free(p);
-		return NULL;
-	}
+	int r = fcb_advance(ctx);
+	if (r < 0)
+		return r;
 
-	if (PKT_ADD(p, FRAME_CANCEL)) {
-		free(p);
-		return NULL;
-	}
-
-	return p;
+	return ret;
 }
 
 /*
- * fcb_send - send a packet.
+ * fcb_send_many - queue @cnt packets and write them out together.
+ *
+ * return - the number of packets queued (all of them, unless the ring
+ *          filled up), or an error <0 if none were.
  */
-ssize_t fcb_send(struct fcb_ctx *ctx, void *data, size_t nbytes)
+int fcb_send_many(struct fcb_ctx *ctx, const struct iovec *pkts, int cnt)
 {
-	fcb_pkt *pk = convert_to_pkt(data, nbytes);
-	if (!pk)
-		return -1;
+	int i;
+	for (i = 0; i < cnt; i++) {
+		ssize_t ret = fcb_queue(ctx, pkts[i].iov_base,
+				pkts[i].iov_len);
+		if (ret < 0) {
+			if (!i)
+				return ret;
+			break;
+		}
+	}
 
-	list_add(&pk->l, ctx->out.pkts);
+	int r = fcb_advance(ctx);
+	if (r < 0)
+		return r;
 
-	return fcb_advance(ctx);
+	return i;
 }
 
-
 /*
  * fcb_recv - get a packet. when no packet is avaliable, returns 0.
- *            otherwise, returns the length of the packet.
+ *            otherwise, returns the length of the packet (which may be
+ *            larger than @nbytes, in which case it was truncated).
  *
- *            XXX: should this block? If it does, we need to be able to
- *            determine if a message is waiting for us.
+ *            Never blocks, use fcb_advance_wait to wait for packets.
  */
 ssize_t fcb_recv(struct fcb_ctx *ctx, void *data, size_t nbytes)
 {
-	fcb_advance(ctx);
-	/* if item exsists in queue, pop off.
-	 * otherwise, try and process a recv. If it returns prior to completion,
-	 * return -1?
-	 */
-	if (!list_empty(&ctx->in.l)) {
-		struct list_head *ipl = ctx->in.l.next;
+	struct fcb_ctx_in *ic = &ctx->in;
 
-		list_del(ipl);
+	int r = fcb_advance(ctx);
+	if (r < 0)
+		return r;
 
-		struct fcb_pkt *pl = pkt_from_list(ipl);
-		size_t pllen = pl->len;
-		memcpy(data, pl->data, MIN(pl->len, nbytes));
+	if (list_empty(&ic->pkts)) {
+		/* no packet here. try again later. */
+		return 0;
+	}
 
-		free(pl);
+	struct fcb_pkt *pl = list_first_entry(&ic->pkts, fcb_pkt, list);
+	size_t pllen = pl->len;
 
-		return pllen;
-	}
+	memcpy(data, pl->data, MIN(pllen, nbytes));
 
-	/* no packet here. try again later. */
-	return 0;
+	list_del(&pl->list);
+	list_add_tail(&pl->list, &ic->free);
+
+	return pllen;
 }
 
 /*
@@ -496,7 +346,11 @@ ssize_t fcb_recv(struct fcb_ctx *ctx, void *data, size_t nbytes)
  */
 int fcb_flush(struct fcb_ctx *ctx)
 {
-	/* try to complete all outputs */
-	return fcb_advance(ctx, -1);
-}
+	while (TX_CNT(&ctx->out)) {
+		int r = fcb_advance_wait(ctx, -1);
+		if (r < 0)
+			return r;
+	}
 
+	return 0;
+}
@@ -0,0 +1,77 @@
+#ifndef HJ_PC_FCB_H_
+#define HJ_PC_FCB_H_
+
+#include <stdint.h>
+#include <stddef.h>
+#include <sys/types.h>
+#include <sys/uio.h>
+
+#include "list.h"
+#include "frame_codec.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * fcb - a non-blocking framed channel over a file descriptor.
+ *
+ * All storage is part of struct fcb_ctx: received bytes are decoded in a
+ * fixed buffer, decoded packets are parked in a fixed pool of slots, and
+ * outgoing frames are encoded straight into a fixed byte ring. Nothing is
+ * allocated once the ctx exists.
+ */
+
+/* raw receive buffer, bounds the largest (escaped) frame accepted */
+#define FCB_RX_SZ   4096
+/* transmit ring, must be a power of 2 */
+#define FCB_TX_SZ   4096
+/* decoded packets held until fcb_recv */
+#define FCB_PKT_CT  32
+/* largest decoded packet held */
+#define FCB_PKT_MAX 256
+
+typedef struct fcb_pkt {
+	struct list_head list;
+	size_t len;
+	uint8_t data[FCB_PKT_MAX];
+} fcb_pkt;
+
+struct fcb_ctx_in {
+	struct frame_dec dec;
+	uint8_t buf[FCB_RX_SZ];
+
+	struct list_head pkts;	/* decoded, oldest first */
+	struct list_head free;
+	struct fcb_pkt pool[FCB_PKT_CT];
+
+	/* good frames lost for lack of a slot, or too large for one */
+	unsigned long dropped;
+};
+
+struct fcb_ctx_out {
+	uint8_t buf[FCB_TX_SZ];
+	/* free running, masked on use */
+	size_t head;	/* next byte to be queued */
+	size_t tail;	/* next byte to be written */
+};
+
+typedef struct fcb_ctx {
+	int fd;
+	struct fcb_ctx_out out;
+	struct fcb_ctx_in in;
+} fcb_ctx;
+
+int fcb_open(struct fcb_ctx *ctx, int fd);
+int fcb_advance_wait(struct fcb_ctx *ctx, int timeout);
+ssize_t fcb_queue(struct fcb_ctx *ctx, const void *data, size_t nbytes);
+ssize_t fcb_send(struct fcb_ctx *ctx, const void *data, size_t nbytes);
+int fcb_send_many(struct fcb_ctx *ctx, const struct iovec *pkts, int cnt);
+ssize_t fcb_recv(struct fcb_ctx *ctx, void *data, size_t nbytes);
+int fcb_flush(struct fcb_ctx *ctx);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -2,53 +2,110 @@
 #include <stdlib.h>
 #include <stdbool.h>
 #include <stdint.h>
+#include <string.h>
 #include <errno.h>
 
 #include <arpa/inet.h>
 #include <frame/frame_proto.h>
 
 #include "crc.h"
-
-#define SEND_BYTE(out, c) do {						\
-	if ((c) == FRAME_START || (c) == FRAME_ESC || (c) == FRAME_RESET) {\
-		fputc(FRAME_ESC, (out));				\
-		fputc(FRAME_ESC_MASK ^ (c), (out));			\
-	} else {							\
-		fputc((c), (out));					\
-	}								\
-} while(0)
+#include "frame_codec.h"
+#include "frame_async.h"
 
 ssize_t frame_send(FILE *out, void *data, size_t nbytes)
 {
-	char *d;
-	char *end;
-	uint16_t crc = FRAME_CRC_INIT;
-
-	fputc(FRAME_START, out);
-	for(d = data, end = d + nbytes; d < end; d++) {
-		char c = *d;
-		crc = crc_ccitt_update(crc, c);
-		SEND_BYTE(out, c);
-	}
+	uint8_t buf[FRAME_ENC_MAX(nbytes)];
+	ssize_t len = frame_encode(buf, sizeof(buf), data, nbytes);
 
-	crc = htons(crc);
+	if (len < 0)
+		return len;
 
-	SEND_BYTE(out, crc >> 8);
-	SEND_BYTE(out, crc & 0xff);
+	/* the whole frame goes out in a single write */
+	if (fwrite(buf, 1, len, out) != (size_t)len)
+		return -EIO;
 
-	fputc(FRAME_START, out);
+	fflush(out);
+	return nbytes;
+}
+
+ssize_t frame_send_many(FILE *out, const struct iovec *frames, int cnt)
+{
+	size_t nbytes = 0;
+	int i;
+	for (i = 0; i < cnt; i++)
+		nbytes += frames[i].iov_len;
+
+	uint8_t buf[FRAME_ENC_MAX(nbytes) + cnt];
+	ssize_t len = frame_encode_many(buf, sizeof(buf), frames, cnt);
+
+	if (len < 0)
+		return len;
+
+	if (fwrite(buf, 1, len, out) != (size_t)len)
+		return -EIO;
 
 	fflush(out);
 	return nbytes;
 }
 
+ssize_t frame_send_many_addr(FILE *out, uint8_t addr,
+		const struct iovec *frames, int cnt)
+{
+	size_t nbytes = 0;
+	int i;
+	for (i = 0; i < cnt; i++)
+		nbytes += frames[i].iov_len;
+
+	uint8_t buf[nbytes + cnt * FRAME_ADDR_SZ];
+	struct iovec v[cnt];
+	uint8_t *p = buf;
+	for (i = 0; i < cnt; i++) {
+		v[i].iov_base = p;
+		v[i].iov_len = FRAME_ADDR_SZ + frames[i].iov_len;
+		*p++ = addr;
+		memcpy(p, frames[i].iov_base, frames[i].iov_len);
+		p += frames[i].iov_len;
+	}
+
+	ssize_t ret = frame_send_many(out, v, cnt);
+	if (ret < 0)
+		return ret;
+	return nbytes;
+}
+
+ssize_t frame_send_addr(FILE *out, uint8_t addr, void *data, size_t nbytes)
+{
+	struct iovec v = { .iov_base = data, .iov_len = nbytes };
+	return frame_send_many_addr(out, addr, &v, 1);
+}
+
+ssize_t frame_recv_addr(FILE *in, uint8_t *addr, void *vbuf, size_t nbytes)
+{
+	uint8_t buf[FRAME_ADDR_SZ + nbytes];
+	ssize_t len;
+
+	do {
+		len = frame_recv(in, buf, sizeof(buf));
+		if (len < 0)
+			return len;
+		/* too short to have an address, not for us */
+	} while (len < FRAME_ADDR_SZ);
+
+	*addr = buf[0];
+	memcpy(vbuf, buf + FRAME_ADDR_SZ, len - FRAME_ADDR_SZ);
+	return len - FRAME_ADDR_SZ;
+}
+
 ssize_t frame_recv(FILE *in, void *vbuf, size_t nbytes)
 {
-	uint16_t crc = FRAME_CRC_INIT;
 	size_t i;
 	char *buf = vbuf;
 	bool recv_started = false;
+	/* FRAME_COBS: a zero ends the current run */
 	bool is_escaped = false;
+#ifdef FRAME_COBS
+	uint8_t cobs_left = 0;
+#endif
 
 	for(i = 0;;) {
 		int data = fgetc(in);
@@ -65,17 +122,24 @@ ssize_t frame_recv(FILE *in, void *vbuf, size_t nbytes)
 			return -255;
 		}
 
-		if (data == FRAME_START) {
+		if (data == FRAME_DELIM) {
+			is_escaped = false;
+#ifdef FRAME_COBS
+			cobs_left = 0;
+#endif
 			if (recv_started) {
 				if (i != 0) {
-					/* success */
-					if (crc == 0) {
+					/* the crc covers its own 2 bytes, so a
+					 * good frame leaves a fixed residue */
+					uint16_t crc = crc_ccitt_block(
+						FRAME_CRC_INIT, buf, i);
+					if (i > FRAME_CRC_SZ
+						&& crc == FRAME_CRC_GOOD) {
 						ungetc(data, in);
 						return i - 2;
 					} else {
 						fprintf(stderr, "crc = %d\n", crc);
 						i = 0;
-						crc = FRAME_CRC_INIT;
 						continue;
 					}
 				}
@@ -88,6 +152,19 @@ ssize_t frame_recv(FILE *in, void *vbuf, size_t nbytes)
 		if (!recv_started)
 			continue;
 
+#ifdef FRAME_COBS
+		if (!cobs_left) {
+			/* a code byte, the zero ending the last run is due */
+			bool zero = is_escaped;
+			cobs_left = data - 1;
+			is_escaped = data != FRAME_COBS_MAX;
+			if (!zero)
+				continue;
+			data = 0;
+		} else {
+			cobs_left--;
+		}
+#else
 		if (data == FRAME_RESET) {
 			/* restart recv */
 			i = 0;
@@ -103,8 +180,7 @@ ssize_t frame_recv(FILE *in, void *vbuf, size_t nbytes)
 			is_escaped = false;
 			data ^= FRAME_ESC_MASK;
 		}
-
-		crc = crc_ccitt_update(crc, (uint8_t)(data & 0xff));
+#endif
 
 		if (i < nbytes) {
 			buf[i] = data;
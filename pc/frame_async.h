@@ -2,16 +2,33 @@
 #define FRAME_ASYNC_H_
 
 #include <stdio.h>
+#include <stdint.h>
 
 #ifdef __cplusplus
 extern "C" {
 #endif
 
 #include <unistd.h>
+#include <sys/uio.h>
 
 ssize_t frame_recv(FILE *in, void *vbuf, size_t nbytes);
 ssize_t frame_send(FILE *out, void *data, size_t nbytes);
 
+/* send several frames in one write, adjacent frames share a flag byte. */
+ssize_t frame_send_many(FILE *out, const struct iovec *frames, int cnt);
+
+/*
+ * Multi-drop lines: each frame starts with an address byte, FRAME_ADDR(node)
+ * of the board it is to (or FRAME_ADDR_BCAST) or from. Only broadcast
+ * commands which get no reply, or the boards' answers will collide.
+ */
+ssize_t frame_send_addr(FILE *out, uint8_t addr, void *data, size_t nbytes);
+ssize_t frame_send_many_addr(FILE *out, uint8_t addr,
+		const struct iovec *frames, int cnt);
+
+/* as frame_recv, with the address byte removed and stored in @addr */
+ssize_t frame_recv_addr(FILE *in, uint8_t *addr, void *vbuf, size_t nbytes);
+
 #ifdef __cplusplus
 }
 #endif
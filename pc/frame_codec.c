@@ -0,0 +1,509 @@
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+#include <errno.h>
+
+#include <frame/frame_proto.h>
+
+#include "crc.h"
+#include "frame_codec.h"
+
+#define MIN(a, b) ((a) < (b) ? (a) : (b))
+
+#if defined(__x86_64__) || defined(__i386__)
+# define FRAME_HAVE_SIMD 1
+# include <immintrin.h>
+#endif
+
+/*** Scanning for bytes which need escaping ***/
+/* FRAME_ESC, FRAME_START and FRAME_RESET are 0x7d, 0x7e and 0x7f, so the
+ * vector versions subtract FRAME_ESC and look for results <= 2 (as
+ * min(x, 2) == x, there being no unsigned byte compare).
+ */
+
+static size_t frame_esc_scan_byte(const uint8_t *buf, size_t len)
+{
+	size_t i;
+	for (i = 0; i < len; i++)
+		if (FRAME_ESC_CHECK(buf[i]))
+			break;
+	return i;
+}
+
+#ifdef FRAME_HAVE_SIMD
+__attribute__((target("sse2")))
+static size_t frame_esc_scan_sse2(const uint8_t *buf, size_t len)
+{
+	const __m128i esc = _mm_set1_epi8(FRAME_ESC);
+	const __m128i two = _mm_set1_epi8(2);
+	size_t i;
+
+	for (i = 0; i + 16 <= len; i += 16) {
+		__m128i v = _mm_loadu_si128((const __m128i *)(buf + i));
+		__m128i d = _mm_sub_epi8(v, esc);
+		__m128i m = _mm_cmpeq_epi8(_mm_min_epu8(d, two), d);
+		unsigned mask = _mm_movemask_epi8(m);
+		if (mask)
+			return i + __builtin_ctz(mask);
+	}
+
+	return i + frame_esc_scan_byte(buf + i, len - i);
+}
+
+__attribute__((target("avx2")))
+static size_t frame_esc_scan_avx2(const uint8_t *buf, size_t len)
+{
+	const __m256i esc = _mm256_set1_epi8(FRAME_ESC);
+	const __m256i two = _mm256_set1_epi8(2);
+	size_t i;
+
+	for (i = 0; i + 32 <= len; i += 32) {
+		__m256i v = _mm256_loadu_si256((const __m256i *)(buf + i));
+		__m256i d = _mm256_sub_epi8(v, esc);
+		__m256i m = _mm256_cmpeq_epi8(_mm256_min_epu8(d, two), d);
+		unsigned mask = _mm256_movemask_epi8(m);
+		if (mask)
+			return i + __builtin_ctz(mask);
+	}
+
+	return i + frame_esc_scan_sse2(buf + i, len - i);
+}
+#endif /* FRAME_HAVE_SIMD */
+
+static size_t (*frame_esc_scan_impl)(const uint8_t *buf, size_t len)
+	= frame_esc_scan_byte;
+
+__attribute__((constructor))
+static void frame_codec_init(void)
+{
+#ifdef FRAME_HAVE_SIMD
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("avx2"))
+		frame_esc_scan_impl = frame_esc_scan_avx2;
+	else if (__builtin_cpu_supports("sse2"))
+		frame_esc_scan_impl = frame_esc_scan_sse2;
+#endif
+}
+
+size_t frame_esc_scan(const uint8_t *buf, size_t len)
+{
+	return frame_esc_scan_impl(buf, len);
+}
+
+/*** Encoding ***/
+#ifdef FRAME_COBS
+/* the run being encoded */
+struct cobs_enc {
+	uint8_t *code;	/* its code byte, filled in when it ends */
+	uint8_t run;	/* its length so far */
+};
+
+/*
+ * frame_cobs_data - COBS encode @len bytes from @src into @o, continuing
+ *                   the run in @e. Runs are copied in one go, up to the
+ *                   next zero.
+ *
+ * return - the new end of the output, or NULL if @end would be passed.
+ */
+static uint8_t *frame_cobs_data(uint8_t *o, uint8_t *end, struct cobs_enc *e,
+		const uint8_t *src, size_t len)
+{
+	while (len) {
+		size_t n = MIN(len, (size_t)(FRAME_COBS_MAX - 1 - e->run));
+		const uint8_t *z = memchr(src, 0, n);
+		size_t run = z ? (size_t)(z - src) : n;
+
+		if ((size_t)(end - o) < run)
+			return NULL;
+		memcpy(o, src, run);
+		o += run;
+		src += run;
+		len -= run;
+		e->run += run;
+
+		if (z) {
+			/* the zero is implied by the end of the run */
+			src++;
+			len--;
+		} else if (e->run != FRAME_COBS_MAX - 1) {
+			break;
+		}
+
+		if (o == end)
+			return NULL;
+		*e->code = e->run + 1;
+		e->code = o++;
+		e->run = 0;
+	}
+
+	return o;
+}
+
+/*
+ * frame_enc_body - encode the payload and crc and close the frame.
+ *
+ * return - the new end of the output, or NULL if @end would be passed.
+ */
+static uint8_t *frame_enc_body(uint8_t *o, uint8_t *end, const void *data,
+		size_t nbytes)
+{
+	uint16_t crc = crc_ccitt_block(FRAME_CRC_INIT, data, nbytes)
+		^ FRAME_CRC_XOR;
+	/* the crc is reflected, so it goes out low byte first */
+	uint8_t crc_b[FRAME_CRC_SZ] = { crc & 0xff, crc >> 8 };
+
+	if (o == end)
+		return NULL;
+	struct cobs_enc e = { .code = o++ };
+
+	o = frame_cobs_data(o, end, &e, data, nbytes);
+	if (!o)
+		return NULL;
+
+	o = frame_cobs_data(o, end, &e, crc_b, sizeof(crc_b));
+	if (!o || o == end)
+		return NULL;
+	*e.code = e.run + 1;
+	*o++ = FRAME_DELIM;
+
+	return o;
+}
+#else
+/*
+ * frame_enc_data - escape @len bytes from @src into @o, copying runs which
+ *                  need no escaping in one go.
+ *
+ * return - the new end of the output, or NULL if @end would be passed.
+ */
+static uint8_t *frame_enc_data(uint8_t *o, uint8_t *end, const uint8_t *src,
+		size_t len)
+{
+	while (len) {
+		size_t run = frame_esc_scan(src, len);
+
+		if ((size_t)(end - o) < run)
+			return NULL;
+		memcpy(o, src, run);
+		o += run;
+		src += run;
+		len -= run;
+
+		if (!len)
+			break;
+
+		if (end - o < 2)
+			return NULL;
+		*o++ = FRAME_ESC;
+		*o++ = *src++ ^ FRAME_ESC_MASK;
+		len--;
+	}
+
+	return o;
+}
+
+/*
+ * frame_enc_body - escape the payload and crc and close the frame.
+ *
+ * return - the new end of the output, or NULL if @end would be passed.
+ */
+static uint8_t *frame_enc_body(uint8_t *o, uint8_t *end, const void *data,
+		size_t nbytes)
+{
+	uint16_t crc = crc_ccitt_block(FRAME_CRC_INIT, data, nbytes);
+	/* the crc is reflected, so it goes out low byte first */
+	uint8_t crc_b[FRAME_CRC_SZ] = { crc & 0xff, crc >> 8 };
+
+	o = frame_enc_data(o, end, data, nbytes);
+	if (!o)
+		return NULL;
+
+	o = frame_enc_data(o, end, crc_b, sizeof(crc_b));
+	if (!o || o == end)
+		return NULL;
+	*o++ = FRAME_START;
+
+	return o;
+}
+#endif
+
+ssize_t frame_encode_cont(void *dst, size_t dst_len, const void *data,
+		size_t nbytes)
+{
+	uint8_t *o = frame_enc_body(dst, (uint8_t *)dst + dst_len, data,
+			nbytes);
+	if (!o)
+		return -ENOSPC;
+
+	return o - (uint8_t *)dst;
+}
+
+ssize_t frame_encode(void *dst, size_t dst_len, const void *data,
+		size_t nbytes)
+{
+	uint8_t *o = dst;
+
+	if (dst_len < 1)
+		return -ENOSPC;
+	*o = FRAME_DELIM;
+
+	ssize_t len = frame_encode_cont(o + 1, dst_len - 1, data, nbytes);
+	if (len < 0)
+		return len;
+
+	return len + 1;
+}
+
+ssize_t frame_encode_many(void *dst, size_t dst_len,
+		const struct iovec *frames, int cnt)
+{
+	uint8_t *o = dst;
+	uint8_t *end = o + dst_len;
+	int i;
+
+	if (dst_len < 1)
+		return -ENOSPC;
+	*o++ = FRAME_DELIM;
+
+	for (i = 0; i < cnt; i++) {
+		o = frame_enc_body(o, end, frames[i].iov_base,
+				frames[i].iov_len);
+		if (!o)
+			return -ENOSPC;
+	}
+
+	return o - (uint8_t *)dst;
+}
+
+/*** Decoding ***/
+void frame_dec_init(struct frame_dec *fd, void *buf, size_t size)
+{
+	fd->buf = buf;
+	fd->size = size;
+	fd->head = 0;
+	fd->pos = 0;
+	fd->start = 0;
+	fd->out = 0;
+	fd->crc = FRAME_CRC_INIT;
+	fd->started = false;
+	fd->esc = false;
+#ifdef FRAME_COBS
+	fd->cobs_left = 0;
+#endif
+	fd->crc_err = 0;
+	fd->overflow = 0;
+}
+
+uint8_t *frame_dec_space(struct frame_dec *fd, size_t *space)
+{
+	/* everything before here is no longer needed */
+	size_t keep = fd->started ? fd->start : fd->pos;
+
+	if (keep) {
+		/* slide the partial frame and any undecoded data down */
+		size_t dec = fd->started ? fd->out - fd->start : 0;
+		size_t raw = fd->head - fd->pos;
+
+		memmove(fd->buf, fd->buf + keep, dec);
+		memmove(fd->buf + dec, fd->buf + fd->pos, raw);
+
+		fd->start = 0;
+		fd->out = dec;
+		fd->pos = dec;
+		fd->head = dec + raw;
+	}
+
+	if (fd->head == fd->size) {
+		/* a single frame fills the buffer, give up on it. */
+		fd->overflow++;
+		fd->started = false;
+		fd->esc = false;
+		fd->head = fd->pos = fd->start = fd->out = 0;
+	}
+
+	*space = fd->size - fd->head;
+	return fd->buf + fd->head;
+}
+
+void frame_dec_commit(struct frame_dec *fd, size_t len)
+{
+	fd->head += len;
+}
+
+size_t frame_dec_feed(struct frame_dec *fd, const void *data, size_t len)
+{
+	size_t space;
+	uint8_t *p = frame_dec_space(fd, &space);
+
+	len = len < space ? len : space;
+	memcpy(p, data, len);
+	frame_dec_commit(fd, len);
+	return len;
+}
+
+/* frame_dec_begin - the flag at fd->pos - 1 opened a new frame */
+static void frame_dec_begin(struct frame_dec *fd)
+{
+	fd->started = true;
+	fd->esc = false;
+	fd->crc = FRAME_CRC_INIT;
+	fd->start = fd->pos;
+	fd->out = fd->pos;
+#ifdef FRAME_COBS
+	fd->cobs_left = 0;
+#endif
+}
+
+/*
+ * frame_dec_end - the flag at fd->pos - 1 closed a frame, and opens the
+ *                 next.
+ *
+ * return - true if it was a good one, with @f set to it.
+ */
+static bool frame_dec_end(struct frame_dec *fd, struct frame_span *f)
+{
+	size_t start = fd->start;
+	size_t len = fd->out - start;
+	uint16_t crc = fd->crc;
+
+	frame_dec_begin(fd);
+
+	if (len == 0)
+		return false;
+
+	/* nothing sends an empty frame, and with FRAME_COBS a corrupt code
+	 * byte leaves runs of zeros which would pass for them */
+	if (len <= FRAME_CRC_SZ || crc != FRAME_CRC_GOOD) {
+		fd->crc_err++;
+		return false;
+	}
+
+	f->data = fd->buf + start;
+	f->len = len - FRAME_CRC_SZ;
+	return true;
+}
+
+/* skip to just past the next flag, and begin a frame there */
+static bool frame_dec_sync(struct frame_dec *fd)
+{
+	uint8_t *b = fd->buf;
+	uint8_t *s = memchr(b + fd->pos, FRAME_DELIM, fd->head - fd->pos);
+	if (!s) {
+		fd->pos = fd->head;
+		return false;
+	}
+
+	fd->pos = s - b + 1;
+	frame_dec_begin(fd);
+	return true;
+}
+
+#ifdef FRAME_COBS
+bool frame_dec_next(struct frame_dec *fd, struct frame_span *f)
+{
+	uint8_t *b = fd->buf;
+
+	while (fd->pos < fd->head) {
+		if (!fd->started) {
+			if (!frame_dec_sync(fd))
+				break;
+			continue;
+		}
+
+		if (fd->cobs_left) {
+			/* the rest of a run, moved down over the code bytes
+			 * before it. A flag within it cuts the frame short. */
+			size_t n = MIN((size_t)fd->cobs_left,
+					fd->head - fd->pos);
+			uint8_t *d = memchr(b + fd->pos, FRAME_DELIM, n);
+			if (d)
+				n = d - (b + fd->pos);
+
+			memmove(b + fd->out, b + fd->pos, n);
+			fd->crc = crc_ccitt_block(fd->crc, b + fd->out, n);
+			fd->out += n;
+			fd->pos += n;
+			fd->cobs_left -= n;
+
+			if (fd->pos == fd->head)
+				break;
+		}
+
+		uint8_t c = b[fd->pos++];
+
+		if (c == FRAME_DELIM) {
+			/* the zero after the last run is not data */
+			if (frame_dec_end(fd, f))
+				return true;
+			continue;
+		}
+
+		/* a code byte, the zero ending the last run (esc) is due */
+		if (fd->esc) {
+			fd->crc = crc_ccitt_update(fd->crc, 0);
+			b[fd->out++] = 0;
+		}
+		fd->cobs_left = c - 1;
+		fd->esc = c != FRAME_COBS_MAX;
+	}
+
+	return false;
+}
+#else
+
+bool frame_dec_next(struct frame_dec *fd, struct frame_span *f)
+{
+	uint8_t *b = fd->buf;
+
+	while (fd->pos < fd->head) {
+		if (!fd->started) {
+			if (!frame_dec_sync(fd))
+				break;
+			continue;
+		}
+
+		if (!fd->esc) {
+			size_t run = frame_esc_scan(b + fd->pos,
+					fd->head - fd->pos);
+
+			/* once anything has been unescaped the decoded data
+			 * trails the raw data and must be moved down */
+			if (fd->out != fd->pos)
+				memmove(b + fd->out, b + fd->pos, run);
+			fd->crc = crc_ccitt_block(fd->crc, b + fd->out, run);
+			fd->out += run;
+			fd->pos += run;
+
+			if (fd->pos == fd->head)
+				break;
+		}
+
+		uint8_t c = b[fd->pos++];
+
+		if (c == FRAME_START) {
+			if (frame_dec_end(fd, f))
+				return true;
+			continue;
+		}
+
+		if (c == FRAME_RESET) {
+			/* abort the frame, wait for the next flag */
+			fd->started = false;
+			fd->esc = false;
+			continue;
+		}
+
+		if (c == FRAME_ESC) {
+			fd->esc = true;
+			continue;
+		}
+
+		/* only reached with fd->esc set */
+		fd->esc = false;
+		c ^= FRAME_ESC_MASK;
+		fd->crc = crc_ccitt_update(fd->crc, c);
+		b[fd->out++] = c;
+	}
+
+	return false;
+}
+#endif
@@ -0,0 +1,143 @@
+#ifndef FRAME_CODEC_H_
+#define FRAME_CODEC_H_
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+#include <sys/types.h>
+#include <sys/uio.h>
+
+#include <frame/frame_proto.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* worst case encoded size of an nbytes payload: every payload and crc byte
+ * escaped (FRAME_COBS: a code byte per 254 and one more), plus the opening
+ * and closing flags. */
+#ifdef FRAME_COBS
+# define FRAME_ENC_MAX(nbytes) \
+	((nbytes) + FRAME_CRC_SZ + ((nbytes) + FRAME_CRC_SZ) / 254 + 1 + 2)
+#else
+# define FRAME_ENC_MAX(nbytes) (2 * ((nbytes) + FRAME_CRC_SZ) + 2)
+#endif
+
+/*
+ * frame_esc_scan - find the first byte in @buf which is special to the
+ *                  framing (FRAME_START, FRAME_ESC or FRAME_RESET).
+ *
+ * return - index of that byte, or @len if there is none.
+ */
+size_t frame_esc_scan(const uint8_t *buf, size_t len);
+
+/*
+ * frame_encode - build a complete frame (flags, escapes and crc) for the
+ *                payload @data in @dst, ready to be handed to a single write.
+ *
+ * @dst:     output buffer, FRAME_ENC_MAX(nbytes) is always large enough.
+ * @dst_len: size of @dst.
+ *
+ * return - the number of bytes placed in @dst, or -ENOSPC if they did not fit.
+ */
+ssize_t frame_encode(void *dst, size_t dst_len, const void *data,
+		size_t nbytes);
+
+/*
+ * frame_encode_cont - as frame_encode, but without the opening flag. Only
+ *                     for use directly after another frame, whose closing
+ *                     flag then doubles as this frame's opening flag.
+ */
+ssize_t frame_encode_cont(void *dst, size_t dst_len, const void *data,
+		size_t nbytes);
+
+/*
+ * frame_encode_many - encode @cnt payloads back to back, sharing the flag
+ *                     between each pair of frames.
+ *
+ * @dst_len: FRAME_ENC_MAX(total payload) + @cnt - 1 is always large enough.
+ */
+ssize_t frame_encode_many(void *dst, size_t dst_len,
+		const struct iovec *frames, int cnt);
+
+/*
+ * Streaming decoder.
+ *
+ * Raw bytes are placed in the decoder's buffer (either read() directly into
+ * the space returned by frame_dec_space() followed by frame_dec_commit(), or
+ * copied in with frame_dec_feed()), then complete frames are pulled out with
+ * frame_dec_next(). Any amount of data may be supplied at a time; a frame
+ * split over several reads is simply resumed.
+ *
+ * Frames are unescaped in place, so every frame is returned as a span
+ * pointing into the decoder's buffer without being copied. A span stays
+ * valid until the next call to frame_dec_space() or frame_dec_feed().
+ */
+struct frame_span {
+	const uint8_t *data;
+	size_t len;
+};
+
+struct frame_dec {
+	uint8_t *buf;
+	size_t size;
+
+	size_t head;	/* end of the raw data */
+	size_t pos;	/* next raw byte to decode */
+	size_t start;	/* start of the frame being decoded */
+	size_t out;	/* end of the decoded part of that frame, <= pos */
+
+	uint16_t crc;
+	bool started;
+	bool esc;	/* FRAME_COBS: a zero ends the current run */
+#ifdef FRAME_COBS
+	uint8_t cobs_left;	/* bytes of the run still to come */
+#endif
+
+	/* frames thrown away */
+	unsigned long crc_err;
+	unsigned long overflow;
+};
+
+/*
+ * frame_dec_init - prepare @fd to decode into @buf. Frames (escaped, with
+ *                  crc) larger than @size are dropped.
+ */
+void frame_dec_init(struct frame_dec *fd, void *buf, size_t size);
+
+/*
+ * frame_dec_space - make room for more raw data.
+ *
+ * @space: set to the number of bytes which may be written to the returned
+ *         pointer.
+ *
+ * return - where the next raw data should be placed.
+ */
+uint8_t *frame_dec_space(struct frame_dec *fd, size_t *space);
+
+/* frame_dec_commit - @len bytes were written to the frame_dec_space() area */
+void frame_dec_commit(struct frame_dec *fd, size_t len);
+
+/*
+ * frame_dec_feed - copy raw data into the decoder.
+ *
+ * return - the number of bytes accepted. Less than @len only when frames are
+ *          not being pulled out with frame_dec_next().
+ */
+size_t frame_dec_feed(struct frame_dec *fd, const void *data, size_t len);
+
+/*
+ * frame_dec_next - decode up to the end of the next good frame.
+ *
+ * @f: set to the frame's payload (crc removed).
+ *
+ * return - true when @f was filled in, false when all data so far has been
+ *          consumed without completing a frame.
+ */
+bool frame_dec_next(struct frame_dec *fd, struct frame_span *f);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
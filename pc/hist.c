@@ -0,0 +1,65 @@
+#include <stdint.h>
+#include <string.h>
+
+#include "hist.h"
+
+static unsigned bucket_of(uint32_t v)
+{
+	if (v < 2 * HIST_SUB)
+		return v;
+
+	unsigned shift = 31 - __builtin_clz(v) - HIST_SUB_BITS;
+	return (shift + 1) * HIST_SUB + (v >> shift) - HIST_SUB;
+}
+
+/* the highest value which falls in bucket @b */
+static uint32_t bucket_top(unsigned b)
+{
+	if (b < 2 * HIST_SUB)
+		return b;
+
+	unsigned shift = b / HIST_SUB - 1;
+	uint64_t lo = (uint64_t)(HIST_SUB + b % HIST_SUB) << shift;
+	return lo + (1ull << shift) - 1;
+}
+
+void hist_init(struct hist *h)
+{
+	memset(h, 0, sizeof(*h));
+	h->min = UINT32_MAX;
+}
+
+void hist_add(struct hist *h, uint32_t v)
+{
+	h->ct[bucket_of(v)]++;
+	h->n++;
+	h->sum += v;
+	if (v < h->min)
+		h->min = v;
+	if (v > h->max)
+		h->max = v;
+}
+
+uint32_t hist_pct(const struct hist *h, double pct)
+{
+	if (!h->n)
+		return 0;
+
+	/* the rank of the value wanted, from 1 */
+	uint64_t want = pct / 100 * h->n;
+	if (want < pct / 100 * h->n)
+		want++;
+	if (!want)
+		want = 1;
+
+	uint64_t seen = 0;
+	unsigned b;
+	for (b = 0; b < HIST_BUCKETS; b++) {
+		seen += h->ct[b];
+		if (seen >= want)
+			break;
+	}
+
+	uint32_t top = bucket_top(b);
+	return top < h->max ? top : h->max;
+}
@@ -0,0 +1,40 @@
+#ifndef HJ_PC_HIST_H_
+#define HJ_PC_HIST_H_
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * hist - a histogram of latencies (or any uint32_t), with the buckets laid
+ *        out as HdrHistogram does: exact below 2 * HIST_SUB, and above that
+ *        HIST_SUB buckets to each power of 2, so any value is given to
+ *        within 1 part in HIST_SUB (1.6%) at a fixed size.
+ */
+
+#define HIST_SUB_BITS 6
+#define HIST_SUB      (1 << HIST_SUB_BITS)
+#define HIST_BUCKETS  ((32 - HIST_SUB_BITS + 1) * HIST_SUB)
+
+struct hist {
+	uint32_t ct[HIST_BUCKETS];
+	uint64_t n;
+	uint64_t sum;
+	uint32_t min;
+	uint32_t max;
+};
+
+void hist_init(struct hist *h);
+void hist_add(struct hist *h, uint32_t v);
+
+/* return: the value @pct percent of those added are no more than (to
+ *         within the bucket's width), 0 if none were */
+uint32_t hist_pct(const struct hist *h, double pct);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
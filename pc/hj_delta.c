@@ -0,0 +1,119 @@
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <errno.h>
+
+#include <arpa/inet.h>
+
+#include "hj_delta.h"
+
+struct delta_rd {
+	const uint8_t *p;
+	const uint8_t *end;
+	bool bad;
+};
+
+static uint32_t varint_get(struct delta_rd *r)
+{
+	uint32_t u = 0;
+	unsigned shift;
+
+	for (shift = 0; shift < 32; shift += 7) {
+		if (r->p == r->end)
+			break;
+		uint8_t b = *r->p++;
+		u |= (uint32_t)(b & ~HJ_VARINT_MORE) << shift;
+		if (!(b & HJ_VARINT_MORE))
+			return u;
+	}
+
+	r->bad = true;
+	return 0;
+}
+
+static int32_t delta_get(struct delta_rd *r)
+{
+	uint32_t u = varint_get(r);
+	return HJ_UNZIGZAG(u);
+}
+
+/* the fields are big endian, as in a HJA_PT_INFO */
+static uint16_t delta16(struct delta_rd *r, uint16_t base)
+{
+	return htons(ntohs(base) + delta_get(r));
+}
+
+static uint32_t delta32(struct delta_rd *r, uint32_t base)
+{
+	return htonl(ntohl(base) + delta_get(r));
+}
+
+static void motor_delta(struct delta_rd *r, struct hj_pktc_motor_info *m,
+		const struct hj_pktc_motor_info *b)
+{
+	m->current = delta16(r, b->current);
+	m->e.p = delta32(r, b->e.p);
+	m->e.n = delta32(r, b->e.n);
+	m->e.l = delta16(r, b->e.l);
+	m->pwr = delta16(r, b->pwr);
+	m->vel = delta16(r, b->vel);
+}
+
+void hj_delta_init(struct hj_delta *d)
+{
+	memset(d, 0, sizeof(*d));
+}
+
+void hj_delta_req(struct hj_delta *d, struct hjb_pkt_req_info_delta *req)
+{
+	struct hjb_pkt_req_info_delta r = HJB_PKT_REQ_INFO_DELTA_INITIALIZER(
+			d->have ? 0 : HJB_INFO_DELTA_KEY, d->newest);
+	*req = r;
+}
+
+int hj_delta_decode(struct hj_delta *d, const void *pkt, size_t len,
+		struct hja_pkt_info *info)
+{
+	const struct hja_pkt_info_delta *p = pkt;
+	static const struct hja_pkt_info zero;
+	const struct hja_pkt_info *b = &zero;
+
+	if (len < HJA_PL_INFO_DELTA_MIN || len > HJA_PL_INFO_DELTA
+			|| p->head.type != HJA_PT_INFO_DELTA)
+		return -EINVAL;
+
+	if (p->base != p->seq) {
+		struct hj_delta_snap *s = &d->snap[p->base % HJ_DELTA_HIST];
+		if (!s->used || s->seq != p->base) {
+			d->missing++;
+			d->have = false;
+			return -ENOENT;
+		}
+		b = &s->info;
+	}
+
+	struct delta_rd r = {
+		.p = p->v,
+		.end = (const uint8_t *)pkt + len,
+	};
+	struct hja_pkt_info i = HJA_PKT_INFO_INITIALIZER;
+	motor_delta(&r, &i.m[0], &b->m[0]);
+	motor_delta(&r, &i.m[1], &b->m[1]);
+	if (r.bad || r.p != r.end)
+		return -EINVAL;
+
+	struct hj_delta_snap *s = &d->snap[p->seq % HJ_DELTA_HIST];
+	s->info = i;
+	s->seq = p->seq;
+	s->used = true;
+	d->newest = p->seq;
+	d->have = true;
+
+	if (b == &zero)
+		d->keys++;
+	else
+		d->deltas++;
+
+	*info = i;
+	return 0;
+}
@@ -0,0 +1,68 @@
+#ifndef HJ_PC_HJ_DELTA_H_
+#define HJ_PC_HJ_DELTA_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "../hj_proto.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * hj_delta - rebuild the hja_pkt_info each HJA_PT_INFO_DELTA stands for.
+ *
+ * The board sends each snapshot as deltas against the one the request
+ * acknowledged, so the last HJ_DELTA_HIST decoded are kept here to undo
+ * them, and the newest is acknowledged in the next request. A reply against
+ * one no longer kept (replies lost or reordered) cannot be decoded, and the
+ * next request asks for a keyframe instead.
+ *
+ * A board which resets numbers its snapshots from 0 again. Deltas against a
+ * snapshot of the same seq from before then decode wrong until its next
+ * keyframe, at most HJ_DELTA_KEY_EVERY later; call hj_delta_init() when
+ * the board says it has reset to avoid that.
+ *
+ * Usage:
+ *   hj_delta_init(), then hj_delta_req() for each request sent and
+ *   hj_delta_decode() for each reply.
+ */
+
+struct hj_delta_snap {
+	struct hja_pkt_info info;
+	uint8_t seq;
+	bool used;
+};
+
+struct hj_delta {
+	struct hj_delta_snap snap[HJ_DELTA_HIST];	/* by seq % HIST */
+	uint8_t newest;
+	bool have;		/* newest is set, and may be acked */
+
+	unsigned long keys;
+	unsigned long deltas;
+	unsigned long missing;	/* against a snapshot we no longer have */
+};
+
+void hj_delta_init(struct hj_delta *d);
+
+/* fill in the request to send next */
+void hj_delta_req(struct hj_delta *d, struct hjb_pkt_req_info_delta *req);
+
+/*
+ * hj_delta_decode - rebuild @info from the HJA_PT_INFO_DELTA in @pkt.
+ *
+ * return: 0 on success,
+ *         -ENOENT if it is against a snapshot no longer kept,
+ *         -EINVAL if it is malformed.
+ */
+int hj_delta_decode(struct hj_delta *d, const void *pkt, size_t len,
+		struct hja_pkt_info *info);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -1,5 +1,6 @@
 #include <stdio.h>
 #include <string.h>
+#include <errno.h>
 #include <inttypes.h>
 #include <arpa/inet.h>
 
@@ -40,6 +41,93 @@ void hj_print_info(struct hja_pkt_info *inf, FILE *out)
 	print_pktc_mi(&inf->m[1], out);
 }
 
+int hj_fields_decode(const void *pkt, size_t len, struct hja_pkt_info *inf,
+		uint32_t *time)
+{
+	const struct hja_pkt_fields *f = pkt;
+	if (len < HJA_PL_FIELDS_MIN || f->head.type != HJA_PT_FIELDS
+			|| len != (size_t)HJA_PL_FIELDS_OF(f->fields,
+				f->motors))
+		return -EINVAL;
+
+	memset(inf, 0, sizeof(*inf));
+	inf->head.type = HJA_PT_INFO;
+
+	const uint8_t *v = f->v;
+	if (f->fields & HJ_FIELD_TIME) {
+		uint32_t t;
+		memcpy(&t, v, sizeof(t));
+		v += sizeof(t);
+		if (time)
+			*time = ntohl(t);
+	}
+
+	int i;
+	for (i = 0; i < 2; i++) {
+		struct hj_pktc_motor_info *m = &inf->m[i];
+		if (!(f->motors & HJ_MOTOR(i)))
+			continue;
+#define FIELD_GET(fl, dst) do {				\
+		if (f->fields & (fl)) {			\
+			memcpy(&(dst), v, sizeof(dst));	\
+			v += sizeof(dst);		\
+		}					\
+	} while (0)
+		FIELD_GET(HJ_FIELD_CURRENT, m->current);
+		FIELD_GET(HJ_FIELD_P, m->e.p);
+		FIELD_GET(HJ_FIELD_N, m->e.n);
+		FIELD_GET(HJ_FIELD_L, m->e.l);
+		FIELD_GET(HJ_FIELD_PWR, m->pwr);
+		FIELD_GET(HJ_FIELD_VEL, m->vel);
+#undef FIELD_GET
+	}
+	return 0;
+}
+
+static void print_fields_mi(struct hj_pktc_motor_info *inf, uint8_t fields,
+		FILE *out)
+{
+	const char *sep = "";
+#define FIELD_PRINT(fl, fmt, val) do {				\
+		if (fields & (fl)) {				\
+			fprintf(out, "%s" fmt, sep, val);	\
+			sep = " ";				\
+		}						\
+	} while (0)
+	FIELD_PRINT(HJ_FIELD_CURRENT, "current: %"PRIu16, ntohs(inf->current));
+	FIELD_PRINT(HJ_FIELD_P, "enc_p: %"PRIu32, ntohl(inf->e.p));
+	FIELD_PRINT(HJ_FIELD_N, "enc_n: %"PRIu32, ntohl(inf->e.n));
+	FIELD_PRINT(HJ_FIELD_L, "enc_l: %"PRIi16, (int16_t)ntohs(inf->e.l));
+	FIELD_PRINT(HJ_FIELD_PWR, "pwr: %"PRIi16, (int16_t)ntohs(inf->pwr));
+	FIELD_PRINT(HJ_FIELD_VEL, "vel: %"PRIi16, (int16_t)ntohs(inf->vel));
+#undef FIELD_PRINT
+}
+
+int hj_print_fields(const void *pkt, size_t len, FILE *out)
+{
+	const struct hja_pkt_fields *f = pkt;
+	struct hja_pkt_info inf;
+	uint32_t time;
+	int r = hj_fields_decode(pkt, len, &inf, &time);
+	if (r < 0)
+		return r;
+
+	const char *sep = "";
+	if (f->fields & HJ_FIELD_TIME) {
+		fprintf(out, "t: %"PRIu32, time);
+		sep = "\t";
+	}
+	int i;
+	for (i = 0; i < 2; i++) {
+		if (!(f->motors & HJ_MOTOR(i)))
+			continue;
+		fprintf(out, "%s%c: ", sep, 'a' + i);
+		print_fields_mi(&inf.m[i], f->fields, out);
+		sep = "\t";
+	}
+	return 0;
+}
+
 void hj_print_error(struct hja_pkt_error *e, FILE *out)
 {
 	char ver[sizeof(e->ver) + 1];
@@ -57,3 +145,23 @@ void hj_print_error(struct hja_pkt_error *e, FILE *out)
 			ntohs(e->line),
 			ntohl(e->errnum));
 }
+
+void hj_print_stats(struct hja_pkt_stats *st, FILE *out)
+{
+	fprintf(out, "rx drops: frame_err: %"PRIu16" overrun: %"PRIu16
+			" parity: %"PRIu16" crc: %"PRIu16" pkt_full: %"PRIu16
+			" buf_full: %"PRIu16" abort: %"PRIu16,
+			ntohs(st->rx_frame_err),
+			ntohs(st->rx_overrun),
+			ntohs(st->rx_parity),
+			ntohs(st->rx_crc),
+			ntohs(st->rx_pkt_full),
+			ntohs(st->rx_buf_full),
+			ntohs(st->rx_abort));
+	fprintf(out, "\ttx drops: full: %"PRIu16, ntohs(st->tx_full));
+	fprintf(out, "\thwm: rx %"PRIu8"B/%"PRIu8"p tx %"PRIu8"B/%"PRIu8"p"
+			" txu %"PRIu8"B/%"PRIu8"p",
+			st->rx_hwm_bytes, st->rx_hwm_pkts,
+			st->tx_hwm_bytes, st->tx_hwm_pkts,
+			st->txu_hwm_bytes, st->txu_hwm_pkts);
+}
@@ -5,5 +5,22 @@
 void hj_print_info(struct hja_pkt_info *inf, FILE *info);
 void hj_print_error(struct hja_pkt_error *e, FILE *out);
 void hj_print_pid_k(struct hj_pkt_pid_k *inf, FILE *out);
+void hj_print_stats(struct hja_pkt_stats *st, FILE *out);
+
+/*
+ * hj_fields_decode - spread the HJA_PT_FIELDS in @pkt (@len bytes long)
+ *                    out over @inf, in network order as the rest are. The
+ *                    fields and motors not sent are zeroed.
+ *
+ * @time: if not NULL, given the HJ_FIELD_TIME stamp (in host order) if it
+ *        was sent, and left alone if not.
+ *
+ * return: 0 on success, -EINVAL if it is malformed.
+ */
+int hj_fields_decode(const void *pkt, size_t len, struct hja_pkt_info *inf,
+		uint32_t *time);
+
+/* print only the fields it holds, return as hj_fields_decode() */
+int hj_print_fields(const void *pkt, size_t len, FILE *out);
 
 #endif
@@ -2,6 +2,7 @@
 #include <stdint.h>
 
 #include <arpa/inet.h>
+#include <sys/uio.h>
 
 #include "frame_async.h"
 #include "term_open.h"
@@ -9,22 +10,61 @@
 
 #include "hj_send.h"
 
+/* address byte for every frame sent, 0 for none */
+static uint8_t hj_addr;
+
+void hj_send_addr(uint8_t addr)
+{
+	hj_addr = addr;
+}
+
+static int hj_frame_send(FILE *out, void *data, size_t nbytes)
+{
+	if (hj_addr)
+		return frame_send_addr(out, hj_addr, data, nbytes);
+	return frame_send(out, data, nbytes);
+}
+
 int hj_send_pid_req(FILE *out)
 {
 	struct hj_pkt_header pr = HJB_PKT_PID_REQ_INITIALIZER;
-	return frame_send(out, &pr, HJB_PL_PID_REQ);
+	return hj_frame_send(out, &pr, HJB_PL_PID_REQ);
 }
 
 int hj_send_req_info(FILE *out)
 {
 	struct hj_pkt_header ri = HJB_PKT_REQ_INFO_INITIALIZER;
-	return frame_send(out, &ri, HJB_PL_REQ_INFO);
+	return hj_frame_send(out, &ri, HJB_PL_REQ_INFO);
 }
 
 int hj_send_set_speed(FILE *sf, int16_t ml, int16_t mr)
 {
 	struct hjb_pkt_set_speed ss =
 		HJB_PKT_SET_SPEED_INITIALIZER(ml, mr);
-	return frame_send(sf, &ss, HJB_PL_SET_SPEED);
+	return hj_frame_send(sf, &ss, HJB_PL_SET_SPEED);
 }
 
+/* PID_REQ, REQ_STATS and SET_SPEED_INFO, leaving in one write and
+ * sharing the flags between them */
+int hj_send_set_speed_poll(FILE *sf, int16_t ml, int16_t mr)
+{
+	struct hj_pkt_header pr = HJB_PKT_PID_REQ_INITIALIZER;
+	struct hjb_pkt_req_stats rs = HJB_PKT_REQ_STATS_INITIALIZER(0);
+	struct hjb_pkt_set_speed_info ss =
+		HJB_PKT_SET_SPEED_INFO_INITIALIZER(ml, mr);
+	struct iovec v[] = {
+		{ .iov_base = &pr, .iov_len = HJB_PL_PID_REQ },
+		{ .iov_base = &rs, .iov_len = HJB_PL_REQ_STATS },
+		{ .iov_base = &ss, .iov_len = HJB_PL_SET_SPEED_INFO },
+	};
+	if (hj_addr)
+		return frame_send_many_addr(sf, hj_addr, v, 3);
+	return frame_send_many(sf, v, 3);
+}
+
+int hj_send_req_stats(FILE *out, bool reset)
+{
+	struct hjb_pkt_req_stats rs =
+		HJB_PKT_REQ_STATS_INITIALIZER(reset ? HJB_REQ_STATS_RESET : 0);
+	return hj_frame_send(out, &rs, HJB_PL_REQ_STATS);
+}
@@ -2,9 +2,16 @@
 #define HJ_SEND_H_
 #include <stdio.h>
 #include <stdint.h>
+#include <stdbool.h>
+
+/* start every frame sent with the address byte @addr (FRAME_ADDR(node)),
+ * for boards built with FRAME_NODE. 0 (the default) sends none. */
+void hj_send_addr(uint8_t addr);
 
 int hj_send_pid_req(FILE *out);
 int hj_send_set_speed(FILE *sf, int16_t ml, int16_t mr);
 int hj_send_req_info(FILE *out);
+int hj_send_set_speed_poll(FILE *sf, int16_t ml, int16_t mr);
+int hj_send_req_stats(FILE *out, bool reset);
 
 #endif
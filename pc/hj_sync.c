@@ -0,0 +1,110 @@
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <errno.h>
+
+#include <arpa/inet.h>
+
+#include "hj_sync.h"
+
+void hj_sync_init(struct hj_sync *s)
+{
+	memset(s, 0, sizeof(*s));
+}
+
+/* fit host - board against board over the samples worth using */
+static void sync_fit(struct hj_sync *s)
+{
+	const struct hj_sync_sample *newest =
+		&s->s[(s->next + HJ_SYNC_N - 1) % HJ_SYNC_N];
+	uint32_t rtt_min = UINT32_MAX;
+	unsigned i;
+
+	for (i = 0; i < s->n; i++) {
+		if (s->s[i].rtt_us < rtt_min)
+			rtt_min = s->s[i].rtt_us;
+	}
+
+	/* relative to the newest, to keep the sums small */
+	int64_t ref = newest->board_us;
+	double sx = 0, sy = 0;
+	int64_t x_lo = INT64_MAX, x_hi = INT64_MIN;
+	unsigned used = 0;
+	for (i = 0; i < s->n; i++) {
+		const struct hj_sync_sample *p = &s->s[i];
+		if (p->rtt_us > rtt_min + HJ_SYNC_SLACK_US)
+			continue;
+		int64_t x = p->board_us - ref;
+		sx += x;
+		sy += p->host_us - p->board_us;
+		if (x < x_lo)
+			x_lo = x;
+		if (x > x_hi)
+			x_hi = x;
+		used++;
+	}
+
+	double mx = sx / used, my = sy / used;
+	double drift = 0;
+	if (x_hi - x_lo >= HJ_SYNC_SPAN_US) {
+		double sxx = 0, sxy = 0;
+		for (i = 0; i < s->n; i++) {
+			const struct hj_sync_sample *p = &s->s[i];
+			if (p->rtt_us > rtt_min + HJ_SYNC_SLACK_US)
+				continue;
+			double dx = (p->board_us - ref) - mx;
+			double dy = (p->host_us - p->board_us) - my;
+			sxx += dx * dx;
+			sxy += dx * dy;
+		}
+		drift = sxy / sxx;
+	}
+
+	s->ref_us = ref;
+	s->off_us = my - drift * mx;
+	s->drift = drift;
+	s->rtt_min_us = rtt_min;
+	s->used = used;
+	s->have = true;
+}
+
+int hj_sync_reply(struct hj_sync *s, const void *pkt, size_t len,
+		uint64_t host_us)
+{
+	const struct hja_pkt_sync *p = pkt;
+	if (len != HJA_PL_SYNC || p->head.type != HJA_PT_SYNC)
+		return -EINVAL;
+
+	uint32_t rtt = (uint32_t)host_us - ntohl(p->host);
+	if (rtt > HJ_SYNC_RTT_MAX_US)
+		return -ETIME;
+
+	uint32_t b = ntohl(p->board);
+	if (s->n)
+		s->board += (int32_t)(b - (uint32_t)s->board);
+	else
+		s->board = b;
+
+	struct hj_sync_sample *n = &s->s[s->next];
+	n->board_us = s->board * HJ_CLOCK_US;
+	n->host_us = host_us - rtt + rtt / 2;
+	n->rtt_us = rtt;
+	s->next = (s->next + 1) % HJ_SYNC_N;
+	if (s->n < HJ_SYNC_N)
+		s->n++;
+
+	sync_fit(s);
+	return 0;
+}
+
+int hj_sync_host_us(const struct hj_sync *s, uint32_t board,
+		uint64_t *host_us)
+{
+	if (!s->have)
+		return -EAGAIN;
+
+	int64_t b = (s->board + (int32_t)(board - (uint32_t)s->board))
+		* HJ_CLOCK_US;
+	*host_us = b + s->off_us + s->drift * (b - s->ref_us);
+	return 0;
+}
@@ -0,0 +1,89 @@
+#ifndef HJ_PC_HJ_SYNC_H_
+#define HJ_PC_HJ_SYNC_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "../hj_proto.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * hj_sync - map the board's clock (HJ_CLOCK_US, as stamped in telemetry)
+ *           onto the host's, from HJB_PT_SYNC exchanges.
+ *
+ * Each exchange gives the board's time at some point between sending the
+ * request and taking the reply, taken to be the midpoint. The last
+ * HJ_SYNC_N are kept, and those whose round trip was no more than
+ * HJ_SYNC_SLACK_US over the quickest (so which sat in no queue) are fitted
+ * with a line: an offset, and the drift of one crystal against the other
+ * once they span HJ_SYNC_SPAN_US. The line's asymmetry (the reply is the
+ * longer) stays in the offset.
+ *
+ * Host times are in us, of any clock which does not jump (CLOCK_MONOTONIC),
+ * the same throughout.
+ *
+ * Usage:
+ *   hj_sync_init(), then send HJB_PKT_SYNC_INITIALIZER(host_us) a few
+ *   times a second and pass each reply to hj_sync_reply(). Once that has succeeded,
+ *   hj_sync_host_us() gives the host time of a board stamp.
+ */
+
+#define HJ_SYNC_N 32
+#define HJ_SYNC_SLACK_US 2000
+#define HJ_SYNC_SPAN_US 1000000
+/* a reply taking longer is to a request from before the host's clock
+ * wrapped in the request, or not ours */
+#define HJ_SYNC_RTT_MAX_US 1000000
+
+struct hj_sync_sample {
+	int64_t board_us;	/* unwrapped */
+	int64_t host_us;	/* midpoint of the exchange */
+	uint32_t rtt_us;
+};
+
+struct hj_sync {
+	struct hj_sync_sample s[HJ_SYNC_N];	/* a ring */
+	unsigned n;
+	unsigned next;
+	int64_t board;		/* newest board time, unwrapped */
+	bool have;		/* an estimate has been made */
+
+	/* host_us = board_us + off_us + drift * (board_us - ref_us) */
+	int64_t ref_us;
+	double off_us;
+	double drift;		/* host us per board us, less 1 */
+	uint32_t rtt_min_us;
+	unsigned used;		/* samples the estimate is from */
+};
+
+void hj_sync_init(struct hj_sync *s);
+
+/*
+ * hj_sync_reply - take the HJA_PT_SYNC in @pkt, received at @host_us, and
+ *                 estimate again.
+ *
+ * return: 0 on success,
+ *         -EINVAL if it is malformed,
+ *         -ETIME if the round trip took over HJ_SYNC_RTT_MAX_US.
+ */
+int hj_sync_reply(struct hj_sync *s, const void *pkt, size_t len,
+		uint64_t host_us);
+
+/*
+ * hj_sync_host_us - the host time of board stamp @board, which must be
+ *                   within 38 hours of the newest reply's.
+ *
+ * return: 0 on success, -EAGAIN if there is no estimate yet.
+ */
+int hj_sync_host_us(const struct hj_sync *s, uint32_t board,
+		uint64_t *host_us);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
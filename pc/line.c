@@ -0,0 +1,106 @@
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <errno.h>
+
+#include <arpa/inet.h>
+
+#include <frame/frame_proto.h>
+
+#include "fcb.h"
+#include "line.h"
+#include "now.h"
+#include "term_open.h"
+#include "../hj_proto.h"
+
+/* wait up to @ms for a HJA_PT_LINE, dropping anything else */
+static int line_wait(fcb_ctx *fcb, struct hja_pkt_line *ack, uint64_t ms)
+{
+	uint64_t end = now_ms() + ms;
+
+	for (;;) {
+		uint8_t buf[HJ_PL_MAX];
+		ssize_t l;
+		while ((l = fcb_recv(fcb, buf, sizeof(buf))) > 0) {
+			if (ack && buf[0] == HJA_PT_LINE && l == HJA_PL_LINE) {
+				memcpy(ack, buf, sizeof(*ack));
+				return 0;
+			}
+		}
+		if (l < 0)
+			return l;
+
+		uint64_t now = now_ms();
+		if (now >= end)
+			return -ETIMEDOUT;
+
+		int r = fcb_advance_wait(fcb, end - now);
+		if (r < 0)
+			return r;
+	}
+}
+
+/* ask for the settings, and return those the board answers with */
+static int line_ask(fcb_ctx *fcb, unsigned long baud, bool parity,
+		struct hja_pkt_line *ack)
+{
+	struct hjb_pkt_set_line req = HJB_PKT_SET_LINE_INITIALIZER(baud,
+			parity ? 0 : HJ_LINE_NO_PARITY);
+	int i;
+
+	for (i = 0; i < LINE_TRIES; i++) {
+		ssize_t r = fcb_send(fcb, &req, HJB_PL_SET_LINE);
+		if (r < 0)
+			return r;
+		r = line_wait(fcb, ack, LINE_ACK_MS);
+		if (r != -ETIMEDOUT)
+			return r;
+	}
+
+	return -ETIMEDOUT;
+}
+
+int line_lost(fcb_ctx *fcb)
+{
+	int r = fcb_flush(fcb);
+	if (r < 0)
+		return r;
+
+	r = term_line(fcb->fd, FRAME_LINE_BAUD, FRAME_LINE_PARITY);
+	if (r < 0)
+		return r;
+
+	r = line_wait(fcb, NULL, LINE_QUIET_MS);
+	return r == -ETIMEDOUT ? 0 : r;
+}
+
+int line_set(fcb_ctx *fcb, unsigned long baud, bool parity)
+{
+	struct hja_pkt_line ack;
+	uint8_t flags = parity ? 0 : HJ_LINE_NO_PARITY;
+
+	int r = line_ask(fcb, baud, parity, &ack);
+	if (r == -ETIMEDOUT) {
+		/* the answer may be what went missing */
+		r = line_lost(fcb);
+		return r < 0 ? r : -ETIMEDOUT;
+	}
+	if (r < 0)
+		return r;
+	if (ntohl(ack.baud) != baud || ack.flags != flags)
+		return -ENOTSUP;
+
+	r = fcb_flush(fcb);
+	if (r < 0)
+		return r;
+	r = term_line(fcb->fd, baud, parity);
+	if (r < 0)
+		return r;
+
+	r = line_ask(fcb, baud, parity, &ack);
+	if (r == -ETIMEDOUT) {
+		r = line_lost(fcb);
+		return r < 0 ? r : -ETIMEDOUT;
+	}
+	return r;
+}
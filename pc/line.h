@@ -0,0 +1,52 @@
+#ifndef HJ_PC_LINE_H_
+#define HJ_PC_LINE_H_
+
+#include <stdbool.h>
+
+#include "fcb.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * line - move the link to a board to other line settings (a higher rate,
+ *        no parity), and back when they stop working.
+ *
+ * The board answers a HJB_PT_SET_LINE at the old settings before taking up
+ * the new ones, so the change is made in two steps: ask, and once answered
+ * switch the port and ask again. The second answer shows the new settings
+ * work both ways.
+ *
+ * When they do not, or later stop working, both ends go back to the
+ * settings at reset (FRAME_LINE_BAUD, odd parity): the board once no frame
+ * has reached it for a watchdog period, the host when told so by
+ * line_lost(), which waits that out before returning.
+ *
+ * Packets other than the answers which arrive meanwhile are dropped.
+ */
+
+#define LINE_ACK_MS   200
+#define LINE_TRIES    3
+/* the board's watchdog period, and then some */
+#define LINE_QUIET_MS 600
+
+/*
+ * line_set - switch to @baud, with odd parity or none.
+ *
+ * return: 0 once both ends use them,
+ *         -ENOTSUP if the board cannot make @baud (nothing changes),
+ *         -ETIMEDOUT if they did not work (both are back to the settings
+ *          at reset),
+ *         or another -errno.
+ */
+int line_set(fcb_ctx *fcb, unsigned long baud, bool parity);
+
+/* the board no longer answers: go back to the settings at reset */
+int line_lost(fcb_ctx *fcb);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -14,6 +14,7 @@
 #include "hj_print.h"
 
 #include "../hj_proto.h"
+#include <frame/frame_proto.h>
 
 #include "term_open.h"
 #include "error_m.h"
@@ -27,11 +28,16 @@
 			continue;					\
 		}
 
-void hj_parse(FILE *sf, int16_t motors[2])
+/* node: the board to talk to on a multi-drop line, <0 when the frames carry
+ * no address. */
+void hj_parse(FILE *sf, int16_t motors[2], int node)
 {
 	char buf[1024];
 	for(;;) {
-		ssize_t len = frame_recv(sf, buf, sizeof(buf));
+		uint8_t from;
+		ssize_t len = node < 0
+			? frame_recv(sf, buf, sizeof(buf))
+			: frame_recv_addr(sf, &from, buf, sizeof(buf));
 		struct hj_pkt_header *h = (typeof(h)) buf;
 
 		if (len < 0) {
@@ -39,12 +45,22 @@ void hj_parse(FILE *sf, int16_t motors[2])
 			exit(EXIT_FAILURE);
 		}
 
+		if (node >= 0 && from != FRAME_ADDR(node)) {
+			/* another board's */
+			continue;
+		}
+
 		switch(h->type) {
 		HJ_CASE(A, TIMEOUT) {
 			fputc('\n', stderr);
-			hj_send_req_info(sf);
-			hj_send_pid_req(sf);
-			hj_send_set_speed(sf, motors[0], motors[1]);
+			hj_send_set_speed_poll(sf, motors[0], motors[1]);
+			break;
+		}
+
+		HJ_CASE(A, STATS) {
+			struct hja_pkt_stats *st = (typeof(st)) buf;
+			hj_print_stats(st, stderr);
+			fputc('\n', stderr);
 			break;
 		}
 
@@ -91,7 +107,7 @@ static int16_t int16_or_die(char *in)
 int main(int argc, char **argv)
 {
 	if (argc < 4) {
-		fprintf(stderr, "usage: %s <file> <motor a> <motor b>\n",
+		fprintf(stderr, "usage: %s <file> <motor a> <motor b> [node]\n",
 				argc?argv[0]:"hj");
 		return -1;
 	}
@@ -106,7 +122,17 @@ int main(int argc, char **argv)
 	motors[0] = int16_or_die(argv[2]);
 	motors[1] = int16_or_die(argv[3]);
 
-	hj_parse(sf, motors);
+	int node = -1;
+	if (argc > 4) {
+		node = strtol(argv[4], NULL, 0);
+		if (node < 0 || node > 63) {
+			ERROR("node must be from 0 to 63: \"%s\"", argv[4]);
+			return 2;
+		}
+		hj_send_addr(FRAME_ADDR(node));
+	}
+
+	hj_parse(sf, motors, node);
 
 	return 0;
 }
@@ -0,0 +1,21 @@
+#include <stdint.h>
+#include <time.h>
+
+#include "now.h"
+
+uint64_t now_ns(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+uint64_t now_us(void)
+{
+	return now_ns() / 1000;
+}
+
+uint64_t now_ms(void)
+{
+	return now_ns() / 1000000;
+}
@@ -0,0 +1,19 @@
+#ifndef HJ_PC_NOW_H_
+#define HJ_PC_NOW_H_
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* the time by CLOCK_MONOTONIC (which does not jump), in ns, us or ms */
+uint64_t now_ns(void);
+uint64_t now_us(void);
+uint64_t now_ms(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
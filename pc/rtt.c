@@ -0,0 +1,281 @@
+/*
+ * rtt - send HJ_PT_ECHO packets to a board at a fixed rate, and report
+ *       the round trip times of their echoes (as percentiles) and how many
+ *       went missing. Optionally moves the line to <baud> first (with no
+ *       parity if "none" follows), then keeps the board hearing from it
+ *       between echoes, and moves it again should the board go back to the
+ *       settings at reset.
+ *
+ *       The first 4 bytes of each echo's data number it, the rest are a
+ *       pattern from that, so echoes which come back altered are counted
+ *       (as bad) rather than timed.
+ *
+ * usage: rtt <file> [rate [size [count [baud [none]]]]]
+ *        rate: echoes a second (100), size: bytes of data (4 to
+ *        HJ_ECHO_MAX, 8), count: echoes to send (1000)
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <errno.h>
+#include <inttypes.h>
+#include <arpa/inet.h>
+
+#include <frame/frame_proto.h>
+
+#include "fcb.h"
+#include "hist.h"
+#include "line.h"
+#include "term_open.h"
+#include "error_m.h"
+#include "now.h"
+#include "../hj_proto.h"
+
+/* an echo which has not come back by then after the last was sent, never
+ * will */
+#define RTT_WAIT_MS 1000
+
+/* with the line moved, the most time let pass without sending anything:
+ * well inside the board's watchdog period, after which it falls back */
+#define RTT_KEEP_MS 200
+
+static fcb_ctx fcb;
+static struct hist h;
+
+/* the line was moved, to these */
+static bool line;
+static unsigned long baud;
+static bool parity;
+static uint64_t kept_us, heard_us;	/* last sent and received anything */
+
+/* each echo's data: its number, then a pattern from that */
+static void echo_fill(struct hj_pkt_echo *e, uint32_t n, size_t size)
+{
+	uint32_t be = htonl(n);
+	size_t i;
+
+	memcpy(e->data, &be, sizeof(be));
+	for (i = sizeof(be); i < size; i++)
+		e->data[i] = n + i;
+}
+
+static uint64_t *sent_us;	/* by number, 0 once answered */
+static unsigned long count, size;
+static unsigned long recv_ct, dup, bad;
+
+static void echo_recv(const uint8_t *buf, ssize_t l, uint64_t at)
+{
+	const struct hj_pkt_echo *e = (const struct hj_pkt_echo *)buf;
+	struct hj_pkt_echo want;
+	uint32_t n;
+
+	if ((size_t)l != HJ_PL_HEADER + size) {
+		bad++;
+		return;
+	}
+
+	memcpy(&n, e->data, sizeof(n));
+	n = ntohl(n);
+	echo_fill(&want, n, size);
+	if (n >= count || memcmp(e->data, want.data, size)) {
+		bad++;
+		return;
+	}
+
+	if (!sent_us[n]) {
+		dup++;
+		return;
+	}
+
+	uint64_t rtt = at - sent_us[n];
+	hist_add(&h, rtt > UINT32_MAX ? UINT32_MAX : rtt);
+	sent_us[n] = 0;
+	recv_ct++;
+}
+
+static int recv_all(void)
+{
+	uint8_t buf[HJ_PL_MAX];
+	ssize_t l;
+
+	while ((l = fcb_recv(&fcb, buf, sizeof(buf))) > 0) {
+		uint64_t at = now_us();
+		heard_us = at;
+		/* bare echoes are line_keep()'s */
+		if (buf[0] == HJ_PT_ECHO && l > HJ_PL_HEADER)
+			echo_recv(buf, l, at);
+	}
+	return l;
+}
+
+/*
+ * line_keep - with the line moved, send a bare echo when nothing else has
+ *             gone out for RTT_KEEP_MS. If the board stops answering (it
+ *             has fallen back), meet it at the settings at reset and move
+ *             the line again.
+ *
+ * return: 1 if the line was moved again, 0, or -errno.
+ */
+static int line_keep(void)
+{
+	if (!line)
+		return 0;
+
+	uint64_t now = now_us();
+	if (now - heard_us >= LINE_QUIET_MS * 1000) {
+		printf("line lost\n");
+		int r = line_lost(&fcb);
+		if (r >= 0)
+			r = line_set(&fcb, baud, parity);
+		if (r < 0)
+			return r;
+		kept_us = heard_us = now_us();
+		return 1;
+	}
+
+	if (now - kept_us >= RTT_KEEP_MS * 1000) {
+		struct hj_pkt_echo e = HJ_PKT_ECHO_INITIALIZER;
+		int r = fcb_send(&fcb, &e, HJ_PL_HEADER);
+		if (r < 0)
+			return r;
+		kept_us = now;
+	}
+	return 0;
+}
+
+int main(int argc, char **argv)
+{
+	if (argc < 2 || argc > 7) {
+		fprintf(stderr, "usage: %s <file> [rate [size [count [baud"
+				" [none]]]]]\n", argc?argv[0]:"rtt");
+		return 2;
+	}
+
+	double rate = argc > 2 ? strtod(argv[2], NULL) : 100;
+	size = argc > 3 ? strtoul(argv[3], NULL, 0) : 8;
+	count = argc > 4 ? strtoul(argv[4], NULL, 0) : 1000;
+	if (rate <= 0) {
+		ERROR("rate must be over 0: \"%s\"", argv[2]);
+		return 2;
+	}
+	if (size < sizeof(uint32_t) || size > HJ_ECHO_MAX) {
+		ERROR("size must be from %zu to %d", sizeof(uint32_t),
+				HJ_ECHO_MAX);
+		return 2;
+	}
+	if (!count || count > UINT32_MAX) {
+		ERROR("count must be from 1 to %"PRIu32, UINT32_MAX);
+		return 2;
+	}
+
+	baud = FRAME_LINE_BAUD;
+	parity = FRAME_LINE_PARITY;
+	if (argc > 5)
+		baud = strtoul(argv[5], NULL, 0);
+	if (argc > 6) {
+		if (strcmp(argv[6], "none")) {
+			ERROR("not \"none\": \"%s\"", argv[6]);
+			return 2;
+		}
+		parity = false;
+	}
+
+	sent_us = calloc(count, sizeof(*sent_us));
+	if (!sent_us) {
+		ERROR("%s", strerror(errno));
+		return 1;
+	}
+
+	FILE *sf = term_open(argv[1]);
+	if (!sf) {
+		ERROR("open: %s", strerror(errno));
+		return 1;
+	}
+
+	int r = fcb_open(&fcb, fileno(sf));
+	if (r < 0) {
+		ERROR("%s", strerror(-r));
+		return 1;
+	}
+
+	line = baud != FRAME_LINE_BAUD || parity != FRAME_LINE_PARITY;
+	if (line) {
+		r = line_set(&fcb, baud, parity);
+		if (r < 0) {
+			ERROR("line: %s", strerror(-r));
+			return 1;
+		}
+	}
+
+	hist_init(&h);
+
+	uint64_t period_us = 1000000 / rate;
+	uint64_t start = now_us(), next = start;
+	unsigned long i = 0;
+	kept_us = heard_us = start;
+	while (i < count) {
+		r = line_keep();
+		if (r < 0)
+			goto err;
+		if (r > 0) {
+			/* those due meanwhile are not made up in a burst */
+			next = now_us();
+		}
+
+		uint64_t now = now_us();
+		if (now >= next) {
+			struct hj_pkt_echo e = HJ_PKT_ECHO_INITIALIZER;
+			echo_fill(&e, i, size);
+			sent_us[i] = now_us();
+			r = fcb_send(&fcb, &e, HJ_PL_HEADER + size);
+			if (r < 0)
+				goto err;
+			kept_us = now;
+			i++;
+			next += period_us;
+			continue;
+		}
+
+		uint64_t wait_ms = (next - now) / 1000;
+		if (line && wait_ms > RTT_KEEP_MS)
+			wait_ms = RTT_KEEP_MS;
+		r = fcb_advance_wait(&fcb, wait_ms);
+		if (r < 0)
+			goto err;
+		r = recv_all();
+		if (r < 0)
+			goto err;
+	}
+
+	uint64_t end = now_us();
+	while (recv_ct < count
+			&& now_us() - end < RTT_WAIT_MS * 1000) {
+		r = line_keep();
+		if (r < 0)
+			goto err;
+		r = fcb_advance_wait(&fcb, 10);
+		if (r < 0)
+			goto err;
+		r = recv_all();
+		if (r < 0)
+			goto err;
+	}
+
+	unsigned long lost = count - recv_ct;
+	printf("%lu sent in %.1fs, %lu bytes each: %lu back, %lu lost (%.2f%%)"
+			" %lu bad %lu dup\n", count, (end - start) / 1e6, size,
+			recv_ct, lost, 100.0 * lost / count, bad, dup);
+	if (h.n)
+		printf("rtt us: min %"PRIu32" mean %.0f p50 %"PRIu32
+				" p99 %"PRIu32" p99.9 %"PRIu32" max %"PRIu32"\n",
+				h.min, (double)h.sum / h.n,
+				hist_pct(&h, 50), hist_pct(&h, 99),
+				hist_pct(&h, 99.9), h.max);
+	return 0;
+
+err:
+	ERROR("%s", strerror(-r));
+	return 1;
+}
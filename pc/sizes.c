@@ -11,5 +11,23 @@ int main(void)
 	PS(A,ERROR);
 	PS(,PID_K);
 	PS(A,INFO);
+	PS(A,STATS);
+	PS(B,REQ_STATS);
+	PS(A,CREDIT);
+	PS(B,REQ_CREDIT);
+	PS(A,INFO_DELTA);
+	PS(A,INFO_DELTA_MIN);
+	PS(B,REQ_INFO_DELTA);
+	PS(A,LINE);
+	PS(B,SET_LINE);
+	PS(A,STREAM);
+	PS(B,SUBSCRIBE);
+	PS(B,SET_SPEED_INFO);
+	PS(A,FIELDS);
+	PS(A,FIELDS_MIN);
+	PS(B,REQ_FIELDS);
+	PS(A,SYNC);
+	PS(B,SYNC);
+	PS(,ECHO);
 	return 0;
 }
@@ -0,0 +1,306 @@
+/*
+ * tlm - request telemetry from a board as fast as it answers, one request
+ *       outstanding at a time, and report the rate of replies and their
+ *       size each second. Asks for HJA_PT_INFO_DELTA (the default) or for
+ *       plain HJA_PT_INFO, for comparison, or for the HJA_PT_FIELDS of
+ *       both motors given by <mask> (HJ_FIELD_*, enc_l and pwr if not
+ *       given), or subscribes to a HJA_PT_STREAM every <period> ticks (1 if
+ *       not given). Optionally moves the line to <baud> first (with no
+ *       parity if "none" follows).
+ *
+ *       Keeps the board's clock synchronised all along, and reports how
+ *       fast it runs, and how old the stamped samples (stream, or fields with
+ *       HJ_FIELD_TIME) are when they arrive.
+ *
+ * usage: tlm <file> [delta|info|fields[:mask]|stream[:period]] [baud [none]]
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <errno.h>
+#include <inttypes.h>
+#include <arpa/inet.h>
+
+#include <frame/frame_proto.h>
+
+#include "fcb.h"
+#include "line.h"
+#include "hj_delta.h"
+#include "hj_sync.h"
+#include "hj_print.h"
+#include "term_open.h"
+#include "error_m.h"
+#include "now.h"
+#include "../hj_proto.h"
+
+/* a request or its reply went missing */
+#define TLM_RTO_MS 100
+/* a subscription is repeated, within the board's watchdog period */
+#define TLM_KEEP_MS 200
+/* between HJB_PT_SYNCs */
+#define TLM_SYNC_MS 250
+
+enum tlm_mode {
+	TLM_DELTA,
+	TLM_INFO,
+	TLM_FIELDS,
+	TLM_STREAM,
+};
+
+static fcb_ctx fcb;
+static struct hj_delta hd;
+static struct hj_sync sy;
+
+/* of samples stamped by the board, since the last report */
+static double lat_sum_us;
+static uint64_t lat_max_us;
+static unsigned long lat_n;
+
+static void lat_add(uint32_t board)
+{
+	uint64_t at, now = now_us();
+	if (hj_sync_host_us(&sy, board, &at) < 0)
+		return;
+	uint64_t lat = now > at ? now - at : 0;
+	lat_sum_us += lat;
+	if (lat > lat_max_us)
+		lat_max_us = lat;
+	lat_n++;
+}
+
+static int req_send(enum tlm_mode mode, uint8_t period, uint8_t fields)
+{
+	switch (mode) {
+	case TLM_DELTA: {
+		struct hjb_pkt_req_info_delta rd;
+		hj_delta_req(&hd, &rd);
+		return fcb_send(&fcb, &rd, HJB_PL_REQ_INFO_DELTA);
+	}
+	case TLM_FIELDS: {
+		struct hjb_pkt_req_fields rf =
+			HJB_PKT_REQ_FIELDS_INITIALIZER(fields, HJ_MOTOR_ALL);
+		return fcb_send(&fcb, &rf, HJB_PL_REQ_FIELDS);
+	}
+	case TLM_STREAM: {
+		struct hjb_pkt_subscribe sub =
+			HJB_PKT_SUBSCRIBE_INITIALIZER(period);
+		return fcb_send(&fcb, &sub, HJB_PL_SUBSCRIBE);
+	}
+	default: {
+		struct hj_pkt_header ri = HJB_PKT_REQ_INFO_INITIALIZER;
+		return fcb_send(&fcb, &ri, HJB_PL_REQ_INFO);
+	}
+	}
+}
+
+int main(int argc, char **argv)
+{
+	if (argc < 2 || argc > 5) {
+		fprintf(stderr, "usage: %s <file>"
+				" [delta|info|fields[:mask]|stream[:period]]"
+				" [baud [none]]\n", argc?argv[0]:"tlm");
+		return 2;
+	}
+
+	enum tlm_mode mode = TLM_DELTA;
+	int period = 1;
+	long fields = HJ_FIELD_L | HJ_FIELD_PWR;
+	if (argc > 2) {
+		if (!strcmp(argv[2], "info")) {
+			mode = TLM_INFO;
+		} else if (!strncmp(argv[2], "fields", 6)) {
+			mode = TLM_FIELDS;
+			if (argv[2][6] == ':')
+				fields = strtol(argv[2] + 7, NULL, 0);
+			else if (argv[2][6])
+				fields = -1;
+			if (fields < 0 || fields
+					> (HJ_FIELD_ALL | HJ_FIELD_TIME)) {
+				ERROR("mask must be from 0 to %#x: \"%s\"",
+						HJ_FIELD_ALL | HJ_FIELD_TIME,
+						argv[2]);
+				return 2;
+			}
+		} else if (!strncmp(argv[2], "stream", 6)) {
+			mode = TLM_STREAM;
+			if (argv[2][6] == ':')
+				period = atoi(argv[2] + 7);
+			else if (argv[2][6])
+				period = 0;
+			if (period < 1 || period > UINT8_MAX) {
+				ERROR("period must be from 1 to 255: \"%s\"",
+						argv[2]);
+				return 2;
+			}
+		} else if (strcmp(argv[2], "delta")) {
+			ERROR("not \"delta\", \"info\", \"fields\" or"
+					" \"stream\": \"%s\"", argv[2]);
+			return 2;
+		}
+	}
+
+	unsigned long baud = FRAME_LINE_BAUD;
+	bool parity = FRAME_LINE_PARITY;
+	if (argc > 3)
+		baud = strtoul(argv[3], NULL, 0);
+	if (argc > 4) {
+		if (strcmp(argv[4], "none")) {
+			ERROR("not \"none\": \"%s\"", argv[4]);
+			return 2;
+		}
+		parity = false;
+	}
+	bool line = baud != FRAME_LINE_BAUD || parity != FRAME_LINE_PARITY;
+
+	FILE *sf = term_open(argv[1]);
+	if (!sf) {
+		ERROR("open: %s", strerror(errno));
+		return 1;
+	}
+
+	int r = fcb_open(&fcb, fileno(sf));
+	if (r < 0) {
+		ERROR("%s", strerror(-r));
+		return 1;
+	}
+
+	hj_delta_init(&hd);
+	hj_sync_init(&sy);
+
+	if (line) {
+		r = line_set(&fcb, baud, parity);
+		if (r < 0) {
+			ERROR("line: %s", strerror(-r));
+			return 1;
+		}
+	}
+
+	unsigned long replies = 0, bytes = 0, bad = 0, timeouts = 0;
+	unsigned long skipped = 0;
+	uint8_t ticks = 0;
+	uint64_t next = now_ms() + 1000;
+	uint64_t sent_ms = 0, reply_ms = now_ms(), sync_ms = 0;
+	bool waiting = false;
+
+	for (;;) {
+		uint64_t now = now_ms();
+		if (waiting && now - sent_ms >= (mode == TLM_STREAM
+					? TLM_KEEP_MS : TLM_RTO_MS)) {
+			if (mode != TLM_STREAM)
+				timeouts++;
+			waiting = false;
+		}
+
+		if (line && now - reply_ms >= LINE_QUIET_MS) {
+			/* the board will have gone back to the line settings
+			 * at reset, meet it there and try again */
+			printf("line lost\n");
+			r = line_lost(&fcb);
+			if (r >= 0)
+				r = line_set(&fcb, baud, parity);
+			if (r < 0) {
+				ERROR("line: %s", strerror(-r));
+				line = false;
+			}
+			reply_ms = now_ms();
+			continue;
+		}
+
+		if (!waiting) {
+			r = req_send(mode, period, fields);
+			if (r < 0)
+				break;
+			sent_ms = now;
+			waiting = true;
+		}
+
+		if (now - sync_ms >= TLM_SYNC_MS) {
+			struct hjb_pkt_sync sync =
+				HJB_PKT_SYNC_INITIALIZER(now_us());
+			r = fcb_send(&fcb, &sync, HJB_PL_SYNC);
+			if (r < 0)
+				break;
+			sync_ms = now;
+		}
+
+		r = fcb_advance_wait(&fcb, 10);
+		if (r < 0)
+			break;
+
+		uint8_t buf[HJ_PL_MAX];
+		ssize_t l;
+		while ((l = fcb_recv(&fcb, buf, sizeof(buf))) > 0) {
+			struct hja_pkt_info inf;
+			if (buf[0] == HJA_PT_SYNC) {
+				hj_sync_reply(&sy, buf, l, now_us());
+				continue;
+			} else if (buf[0] == HJA_PT_INFO && l == HJA_PL_INFO) {
+				waiting = false;
+			} else if (buf[0] == HJA_PT_FIELDS) {
+				uint32_t t;
+				waiting = false;
+				if (hj_fields_decode(buf, l, &inf, &t) < 0) {
+					bad++;
+					continue;
+				}
+				if (buf[1] & HJ_FIELD_TIME)
+					lat_add(t);
+			} else if (buf[0] == HJA_PT_STREAM
+					&& l == HJA_PL_STREAM) {
+				struct hja_pkt_stream *st =
+					(struct hja_pkt_stream *)buf;
+				skipped += st->skipped;
+				ticks = st->period;
+				lat_add(ntohl(st->time));
+			} else if (buf[0] == HJA_PT_INFO_DELTA) {
+				waiting = false;
+				if (hj_delta_decode(&hd, buf, l, &inf) < 0) {
+					bad++;
+					continue;
+				}
+			} else {
+				continue;
+			}
+			reply_ms = now_ms();
+			replies++;
+			bytes += l;
+		}
+		if (l < 0) {
+			r = l;
+			break;
+		}
+
+		now = now_ms();
+		if (now >= next) {
+			printf("%lu info/s  %.1f bytes each  ", replies,
+					replies ? (double)bytes / replies : 0.0);
+			if (mode == TLM_STREAM)
+				printf("period %u skipped %lu", ticks,
+						skipped);
+			else
+				printf("keys %lu deltas %lu missing %lu bad %lu"
+						" timeouts %lu", hd.keys,
+						hd.deltas, hd.missing, bad,
+						timeouts);
+			if (sy.have)
+				printf("  board %+.1fppm rtt %"PRIu32"us",
+						-sy.drift * 1e6, sy.rtt_min_us);
+			if (lat_n)
+				printf("  age %.1f/%.1fms", lat_sum_us / lat_n
+						/ 1000, lat_max_us / 1000.0);
+			putchar('\n');
+			fflush(stdout);
+			replies = 0;
+			bytes = 0;
+			lat_sum_us = 0;
+			lat_max_us = 0;
+			lat_n = 0;
+			next += 1000;
+		}
+	}
+
+	ERROR("%s", strerror(-r));
+	return 1;
+}
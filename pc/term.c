@@ -1,37 +1,49 @@
 #include <stdio.h>
+#include <stdbool.h>
 #include <errno.h>
 #include <sys/types.h>
 #include <sys/stat.h>
+#include <sys/ioctl.h>
 #include <fcntl.h>
-
-#include <termios.h>
 #include <unistd.h>
 
+/* termios2, for BOTHER: any rate, not just the Bnnnn ones. Clashes with
+ * <termios.h>, so none of its helpers are used here. */
+#include <asm/termbits.h>
+
 #include <string.h>
 
-static int serial_conf(int fd, speed_t speed)
+#include <frame/frame_proto.h>
+
+#include "term_open.h"
+
+/* @flush: drop whatever is queued both ways, rather than wait for the
+ *         output to drain */
+static int serial_conf(int fd, unsigned long baud, bool parity, bool flush)
 {
-	return 0;
-	struct termios t;
-	int ret = tcgetattr(fd, &t);
+	struct termios2 t;
+	int ret = ioctl(fd, TCGETS2, &t);
 
 	if (ret < 0)
 		return ret;
 
-	cfmakeraw(&t);
+	/* raw, as cfmakeraw() */
+	t.c_iflag &= ~(IGNBRK | BRKINT | PARMRK | ISTRIP | INLCR | IGNCR
+			| ICRNL);
+	t.c_oflag &= ~OPOST;
+	t.c_lflag &= ~(ECHO | ECHONL | ICANON | ISIG | IEXTEN);
 	t.c_cc[VMIN] = 1;
 	t.c_cc[VTIME] = 0;
 
-	ret = cfsetispeed(&t, speed);
-	if (ret < 0)
-		return ret;
-
-	ret = cfsetospeed(&t, speed);
-	if (ret < 0)
-		return ret;
+	t.c_cflag &= ~(CBAUD | (CBAUD << IBSHIFT));
+	t.c_cflag |= BOTHER | (BOTHER << IBSHIFT);
+	t.c_ispeed = baud;
+	t.c_ospeed = baud;
 
-	/* odd parity */
-	t.c_cflag |= PARENB | PARODD;
+	/* odd parity, or none */
+	t.c_cflag &= ~(PARENB | PARODD);
+	if (parity)
+		t.c_cflag |= PARENB | PARODD;
 
 	/* 8 data bits */
 	t.c_cflag = (t.c_cflag & ~CSIZE) | CS8;
@@ -45,7 +57,15 @@ static int serial_conf(int fd, speed_t speed)
 
 	/* hupcl */
 
-	return tcsetattr(fd, TCSAFLUSH, &t);
+	return ioctl(fd, flush ? TCSETSF2 : TCSETSW2, &t);
+}
+
+int term_line(int fd, unsigned long baud, bool parity)
+{
+	int ret = serial_conf(fd, baud, parity, false);
+	if (ret < 0)
+		return errno == ENOTTY ? 0 : -errno;
+	return 0;
 }
 
 FILE *term_open(char const *fname)
@@ -55,8 +75,9 @@ FILE *term_open(char const *fname)
 		return NULL;
 	}
 
-	int ret = serial_conf(sfd, B57600);
-	if (ret < 0) {
+	/* not a tty (a pipe or socket to a simulation, say): nothing to set */
+	int ret = serial_conf(sfd, FRAME_LINE_BAUD, FRAME_LINE_PARITY, true);
+	if (ret < 0 && errno != ENOTTY) {
 		return NULL;
 	}
 
@@ -67,4 +88,3 @@ FILE *term_open(char const *fname)
 
 	return sf;
 }
-
@@ -2,13 +2,21 @@
 #define HJ_PC_TERM_H_
 
 #include <stdio.h>
+#include <stdbool.h>
 
 #ifdef __cplusplus
 extern "C" {
 #endif
 
+/* open a serial port at FRAME_LINE_BAUD, odd parity */
 FILE *term_open(char const *fname);
 
+/* switch the port on @fd to @baud (any rate the driver can make), with odd
+ * parity or none, once its output has drained. Nothing is done to a file
+ * which is not a tty.
+ * return: 0, or -errno */
+int term_line(int fd, unsigned long baud, bool parity);
+
 #ifdef __cplusplus
 }
 #endif
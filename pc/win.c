@@ -0,0 +1,235 @@
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <errno.h>
+
+#include "fcb.h"
+#include "now.h"
+#include "win.h"
+
+#define MIN(a, b) ((a) < (b) ? (a) : (b))
+
+#define SEQ_NEXT(s)   (((s) + 1) & FRAME_SEQ_MASK)
+#define SEQ_SUB(a, b) (((a) - (b)) & FRAME_SEQ_MASK)
+
+/* queue a frame: [addr] ctrl data */
+static int win_tx(win *w, uint8_t ctrl, const void *data, size_t len)
+{
+	uint8_t buf[FRAME_ADDR_SZ + FRAME_CTRL_SZ + len];
+	size_t l = 0;
+
+	if (w->addr)
+		buf[l++] = w->addr;
+	buf[l++] = ctrl;
+	memcpy(buf + l, data, len);
+
+	ssize_t r = fcb_queue(w->fcb, buf, l + len);
+	return r < 0 ? r : 0;
+}
+
+/* @pf: poll, the board answers with its N(R) if it has the frame already */
+static int req_tx(win *w, uint8_t ns, bool pf)
+{
+	struct win_req *r = &w->req[ns];
+	r->sent_ms = now_ms();
+	return win_tx(w, FRAME_CTRL_I(ns, w->vr) | (pf ? FRAME_CTRL_PF : 0),
+			r->data, r->len);
+}
+
+/*
+ * win_resend - send every outstanding request again, oldest first.
+ *
+ * @poll: the acks may have been lost rather than the requests, so have the
+ *        board tell us how far it got.
+ */
+static int win_resend(win *w, bool poll)
+{
+	uint8_t s;
+	for (s = w->va; s != w->vs; s = SEQ_NEXT(s)) {
+		int r = req_tx(w, s, poll && s == w->va);
+		if (r < 0)
+			return r;
+		w->resent++;
+	}
+	return 0;
+}
+
+/*
+ * win_reset - give up on the outstanding requests which may not be run
+ *             twice, reset the link, and renumber and resend the rest.
+ */
+static int win_reset(win *w)
+{
+	struct win_req keep[WIN_SZ];
+	unsigned i, n = 0;
+	uint8_t s;
+
+	for (s = w->va; s != w->vs; s = SEQ_NEXT(s)) {
+		if (w->req[s].idempotent)
+			keep[n++] = w->req[s];
+		else
+			w->lost++;
+	}
+
+	w->vs = 0;
+	w->va = 0;
+	w->vr = 0;
+	w->reset = true;
+	w->reset_ms = now_ms();
+
+	int r = win_tx(w, FRAME_CTRL_SABM | FRAME_CTRL_PF, NULL, 0);
+	if (r < 0)
+		return r;
+
+	for (i = 0; i < n; i++) {
+		w->req[w->vs] = keep[i];
+		r = req_tx(w, w->vs, false);
+		if (r < 0)
+			return r;
+		w->vs = SEQ_NEXT(w->vs);
+		w->resent++;
+	}
+
+	return fcb_advance_wait(w->fcb, 0);
+}
+
+/* the board has taken every request before @nr */
+static bool win_ack(win *w, uint8_t nr)
+{
+	/* older than what we have (or not ours at all) */
+	if (SEQ_SUB(nr, w->va) > SEQ_SUB(w->vs, w->va))
+		return false;
+
+	w->va = nr;
+	return true;
+}
+
+int win_init(win *w, fcb_ctx *fcb, uint8_t addr)
+{
+	memset(w, 0, sizeof(*w));
+	w->fcb = fcb;
+	w->addr = addr;
+	return win_reset(w);
+}
+
+int win_space(win *w)
+{
+	return WIN_SZ - SEQ_SUB(w->vs, w->va);
+}
+
+int win_send(win *w, const void *data, size_t len, bool idempotent)
+{
+	if (len > WIN_PKT_MAX)
+		return -EMSGSIZE;
+
+	if (win_space(w) <= 0)
+		return -EAGAIN;
+
+	uint8_t ns = w->vs;
+	struct win_req *r = &w->req[ns];
+	memcpy(r->data, data, len);
+	r->len = len;
+	r->idempotent = idempotent;
+
+	int ret = req_tx(w, ns, false);
+	if (ret < 0)
+		return ret;
+
+	w->vs = SEQ_NEXT(ns);
+	w->sent++;
+
+	ret = fcb_advance_wait(w->fcb, 0);
+	if (ret < 0)
+		return ret;
+	return ns;
+}
+
+int win_poll(win *w, int timeout)
+{
+	int r = fcb_advance_wait(w->fcb, timeout);
+	if (r < 0)
+		return r;
+
+	uint64_t now = now_ms();
+	if (w->reset) {
+		/* the SABM or its UA went missing */
+		if (now - w->reset_ms >= WIN_RTO_MS)
+			return win_reset(w);
+		return 0;
+	}
+
+	if (w->va == w->vs || now - w->req[w->va].sent_ms < WIN_RTO_MS)
+		return 0;
+
+	uint8_t s;
+	for (s = w->va; s != w->vs; s = SEQ_NEXT(s)) {
+		if (!w->req[s].idempotent)
+			return win_reset(w);
+	}
+
+	r = win_resend(w, true);
+	if (r < 0)
+		return r;
+	return fcb_advance_wait(w->fcb, 0);
+}
+
+ssize_t win_recv(win *w, void *buf, size_t len, int *req)
+{
+	size_t hdr = (w->addr ? FRAME_ADDR_SZ : 0) + FRAME_CTRL_SZ;
+
+	for (;;) {
+		uint8_t pkt[FCB_PKT_MAX];
+		ssize_t l = fcb_recv(w->fcb, pkt, sizeof(pkt));
+		if (l <= 0)
+			return l;
+
+		if ((size_t)l < hdr || (w->addr && pkt[0] != w->addr)) {
+			/* another board's, or not from a FRAME_SEQ one */
+			continue;
+		}
+
+		uint8_t ctrl = pkt[hdr - 1];
+		uint8_t nr = FRAME_CTRL_NR(ctrl);
+		l = MIN((size_t)l, sizeof(pkt)) - hdr;
+
+		if (FRAME_CTRL_IS_I(ctrl)) {
+			*req = -1;
+			/* until the UA, frames may be numbered from before
+			 * the reset */
+			if (!w->reset) {
+				uint8_t ns = FRAME_CTRL_NS(ctrl);
+				w->rx_gap += SEQ_SUB(ns, w->vr);
+				w->vr = SEQ_NEXT(ns);
+				win_ack(w, nr);
+				*req = SEQ_SUB(nr, 1);
+			}
+		} else if (FRAME_CTRL_IS_S(ctrl)) {
+			if (w->reset || !win_ack(w, nr))
+				continue;
+			if (FRAME_CTRL_IS_REJ(ctrl)) {
+				/* never run, so safe to send again whatever
+				 * they are */
+				int r = win_resend(w, false);
+				if (r < 0)
+					return r;
+				r = fcb_advance_wait(w->fcb, 0);
+				if (r < 0)
+					return r;
+			}
+			continue;
+		} else if (FRAME_CTRL_U(ctrl) == FRAME_CTRL_UA) {
+			w->reset = false;
+			continue;
+		} else if (FRAME_CTRL_U(ctrl) == FRAME_CTRL_UI) {
+			*req = -1;
+		} else {
+			continue;
+		}
+
+		if (!l)
+			continue;
+
+		memcpy(buf, pkt + hdr, MIN((size_t)l, len));
+		return l;
+	}
+}
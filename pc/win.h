@@ -0,0 +1,111 @@
+#ifndef HJ_PC_WIN_H_
+#define HJ_PC_WIN_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <sys/types.h>
+
+#include <frame/frame_proto.h>
+
+#include "fcb.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * win - a sliding window of numbered (I) frames to a board built with
+ *       FRAME_SEQ, over an fcb.
+ *
+ * Up to WIN_SZ requests may be outstanding at once. The board takes them
+ * strictly in order and acknowledges them cumulatively, by the N(R) of its
+ * replies (or an RR), so each reply is matched to the request it follows.
+ *
+ * A request is lost when the board answers with a REJ (it was never run, it
+ * and everything after it is sent again), or when no ack for it arrives
+ * within WIN_RTO_MS. In that case the board may or may not have run it, so
+ * only idempotent requests are sent again. Those which are not are given up
+ * (counted in lost), and the link reset with a SABM before the rest are
+ * renumbered and resent.
+ *
+ * Usage:
+ *   win_init(), win_send() up to win_space(), then loop on win_poll() and
+ *   win_recv() (until it returns 0), sending more as space opens up.
+ */
+
+/* requests outstanding, at most FRAME_SEQ_MOD - 1 */
+#define WIN_SZ      4
+#define WIN_RTO_MS  100
+#define WIN_PKT_MAX 64
+
+struct win_req {
+	uint64_t sent_ms;
+	bool idempotent;
+	uint8_t len;
+	uint8_t data[WIN_PKT_MAX];
+};
+
+typedef struct win {
+	fcb_ctx *fcb;
+	uint8_t addr;		/* FRAME_ADDR(node), 0 for none */
+
+	uint8_t vs;		/* N(S) of the next request */
+	uint8_t va;		/* N(S) of the oldest unacknowledged one */
+	uint8_t vr;		/* N(S) expected of the board's next I frame */
+	bool reset;		/* SABM sent, no UA yet */
+	uint64_t reset_ms;
+
+	/* indexed by N(S) */
+	struct win_req req[FRAME_SEQ_MOD];
+
+	unsigned long sent;	/* requests, not counting resends */
+	unsigned long resent;
+	unsigned long lost;	/* given up, see above */
+	unsigned long rx_gap;	/* the board's I frames missed */
+} win;
+
+/*
+ * win_init - reset the link (the board's counts too), and empty the window.
+ *
+ * @addr: FRAME_ADDR(node) for a FRAME_NODE board, 0 for none.
+ */
+int win_init(win *w, fcb_ctx *fcb, uint8_t addr);
+
+/* return: how many more requests may be sent now */
+int win_space(win *w);
+
+/*
+ * win_send - number and send a request.
+ *
+ * @idempotent: the request may be run twice, and so is sent again if lost.
+ *
+ * return: its N(S) (matched by win_recv's @req), -EAGAIN when the window is
+ *         full, or another error <0.
+ */
+int win_send(win *w, const void *data, size_t len, bool idempotent);
+
+/*
+ * win_poll - wait up to @timeout ms (<0 forever) for the fd, and send again
+ *            whatever has gone unacknowledged too long.
+ *
+ * return: <0 on error, 0 otherwise.
+ */
+int win_poll(win *w, int timeout);
+
+/*
+ * win_recv - get the next reply from the board, handling the link's own
+ *            frames on the way.
+ *
+ * @req: set to the N(S) of the last request the board had taken when it
+ *       sent the reply, or -1 for unnumbered (UI) frames, ie: timeouts.
+ *
+ * return: the reply's length (truncated to @len when longer), 0 when there
+ *         is none, or an error <0.
+ */
+ssize_t win_recv(win *w, void *buf, size_t len, int *req);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
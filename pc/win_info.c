@@ -0,0 +1,105 @@
+/*
+ * wi - keep a window of REQ_INFO requests outstanding to a FRAME_SEQ board,
+ *      and report the rate of INFO replies and the link's losses each
+ *      second. With a window of 1 it works stop-and-wait, for comparison.
+ *
+ * usage: wi <file> [window] [node]
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+
+#include <frame/frame_proto.h>
+
+#include "fcb.h"
+#include "win.h"
+#include "term_open.h"
+#include "error_m.h"
+#include "now.h"
+#include "../hj_proto.h"
+
+static fcb_ctx fcb;
+static win w;
+
+int main(int argc, char **argv)
+{
+	if (argc < 2) {
+		fprintf(stderr, "usage: %s <file> [window] [node]\n",
+				argc?argv[0]:"wi");
+		return 2;
+	}
+
+	int window = argc > 2 ? atoi(argv[2]) : WIN_SZ;
+	if (window < 1 || window > WIN_SZ) {
+		ERROR("window must be from 1 to %d", WIN_SZ);
+		return 2;
+	}
+
+	uint8_t addr = 0;
+	if (argc > 3) {
+		int node = strtol(argv[3], NULL, 0);
+		if (node < 0 || node > 63) {
+			ERROR("node must be from 0 to 63: \"%s\"", argv[3]);
+			return 2;
+		}
+		addr = FRAME_ADDR(node);
+	}
+
+	FILE *sf = term_open(argv[1]);
+	if (!sf) {
+		ERROR("open: %s", strerror(errno));
+		return 1;
+	}
+
+	int r = fcb_open(&fcb, fileno(sf));
+	if (r < 0 || (r = win_init(&w, &fcb, addr)) < 0) {
+		ERROR("%s", strerror(-r));
+		return 1;
+	}
+
+	struct hj_pkt_header ri = HJB_PKT_REQ_INFO_INITIALIZER;
+	unsigned long info = 0;
+	uint64_t next = now_ms() + 1000;
+
+	for (;;) {
+		while (WIN_SZ - win_space(&w) < window) {
+			r = win_send(&w, &ri, HJB_PL_REQ_INFO, true);
+			if (r < 0)
+				break;
+		}
+		/* -EAGAIN: the window is full after all, wait for it */
+		if (r < 0 && r != -EAGAIN)
+			break;
+
+		r = win_poll(&w, 10);
+		if (r < 0)
+			break;
+
+		uint8_t buf[HJ_PL_MAX];
+		int req;
+		ssize_t l;
+		while ((l = win_recv(&w, buf, sizeof(buf), &req)) > 0) {
+			if (buf[0] == HJA_PT_INFO && l == HJA_PL_INFO)
+				info++;
+		}
+		if (l < 0) {
+			r = l;
+			break;
+		}
+
+		uint64_t now = now_ms();
+		if (now >= next) {
+			printf("%lu info/s  sent %lu resent %lu lost %lu"
+					" rx_gap %lu\n", info, w.sent,
+					w.resent, w.lost, w.rx_gap);
+			fflush(stdout);
+			info = 0;
+			next += 1000;
+		}
+	}
+
+	ERROR("%s", strerror(-r));
+	return 1;
+}